@@ -0,0 +1,202 @@
+/* See LICENSE file for copyright and license details. */
+#include "cg-base.h"
+#include "cg-kernel.h"
+
+#include <libclut.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+
+
+/**
+ * The curves that are baked, the names
+ * of their constants, and the names of
+ * their tables
+ */
+static const struct {
+	enum baked_curve curve;
+	const char *constant;
+	const char *name;
+} curves[] = {
+#define X(CURVE, NAME) {CURVE, #CURVE, NAME}
+	X(BAKED_DARKROOM,    "darkroom"),
+	X(BAKED_SHALLOW,     "shallow"),
+	X(BAKED_NEGATIVE,    "negative"),
+	X(BAKED_LINEARISE,   "linearise"),
+	X(BAKED_STANDARDISE, "standardise")
+#undef X
+};
+
+/**
+ * The sizes the curves are baked for
+ */
+static const size_t sizes[] = {
+#define X(N) N,
+	LIST_BAKED_SIZES
+#undef X
+};
+
+/**
+ * cg-bake is linked with cg-kernel.c, which looks up baked
+ * curves, but it does not have any baked curves itself
+ */
+const struct baked_table baked_tables[] = {{BAKED_KEEP, 0, LIBCOOPGAMMA_DOUBLE, NULL}};
+const size_t baked_tables_n = 0;
+
+
+
+/**
+ * Calculate a curve, in the red channel, in the
+ * same way as the programs do when the curve
+ * is not baked, so that the baked curve is
+ * identical to the calculated curve
+ * 
+ * @param  filter  The filter, its depth and ramp sizes must be set,
+ *                 the green and blue channels must be empty
+ * @param  curve   The curve
+ */
+static void
+calculate(libcoopgamma_filter_t *filter, enum baked_curve curve)
+{
+	struct kernel kernels[3] = {{.reverse = 1}, {.reverse = 0}, {.reverse = 0}};
+
+	if (curve == BAKED_DARKROOM) {
+		/* cg-darkroom fills the ramps with kernels rather than with libclut */
+		kernel_push(&kernels[0], KERNEL_CIE_SCALE, BAKED_DARKROOM_BRIGHTNESS, 0);
+		kernel_fill(filter, kernels);
+		return;
+	}
+
+	switch (filter->depth) {
+#define X(CONST, MEMBER, MAX, TYPE)\
+	case CONST:\
+		libclut_start_over(&filter->ramps.MEMBER, MAX, TYPE, 1, 0, 0);\
+		switch (curve) {\
+		case BAKED_SHALLOW:\
+			libclut_lower_resolution(&filter->ramps.MEMBER, MAX, TYPE, 0, BAKED_SHALLOW_RESOLUTION, 0, 0, 0, 0);\
+			break;\
+		case BAKED_NEGATIVE:\
+			libclut_negative(&filter->ramps.MEMBER, MAX, TYPE, 1, 0, 0);\
+			break;\
+		case BAKED_LINEARISE:\
+			libclut_linearise(&filter->ramps.MEMBER, MAX, TYPE, 1, 0, 0);\
+			break;\
+		case BAKED_STANDARDISE:\
+			libclut_standardise(&filter->ramps.MEMBER, MAX, TYPE, 1, 0, 0);\
+			break;\
+		default:\
+			abort();\
+		}\
+		break;
+	LIST_DEPTHS
+#undef X
+	default:
+		abort();
+	}
+}
+
+
+/**
+ * Print the stops of the red channel of a filter
+ * as C source code, integer stops are printed as
+ * hexadecimal integers and floating-point stops
+ * are printed as hexadecimal floating-point, so
+ * that they are exact
+ * 
+ * @param  filter  The filter
+ */
+static void
+print_stops(const libcoopgamma_filter_t *filter)
+{
+	size_t i, n = filter->ramps.u8.red_size;
+	for (i = 0; i < n; i++) {
+		switch (filter->depth) {
+		case LIBCOOPGAMMA_UINT8:
+			printf("\t0x%x", (unsigned)filter->ramps.u8.red[i]);
+			break;
+		case LIBCOOPGAMMA_UINT16:
+			printf("\t0x%x", (unsigned)filter->ramps.u16.red[i]);
+			break;
+		case LIBCOOPGAMMA_UINT32:
+			printf("\tUINT32_C(0x%lx)", (unsigned long)filter->ramps.u32.red[i]);
+			break;
+		case LIBCOOPGAMMA_UINT64:
+			printf("\tUINT64_C(0x%llx)", (unsigned long long)filter->ramps.u64.red[i]);
+			break;
+		case LIBCOOPGAMMA_FLOAT:
+			printf("\t%af", (double)filter->ramps.f.red[i]);
+			break;
+		case LIBCOOPGAMMA_DOUBLE:
+			printf("\t%a", filter->ramps.d.red[i]);
+			break;
+		default:
+			abort();
+		}
+		printf("%s\n", i + 1 < n ? "," : "");
+	}
+}
+
+
+/**
+ * Print C source code with the baked curves,
+ * for `baked_tables` and `baked_tables_n`,
+ * to stdout
+ * 
+ * @return  0 on success, 1 on error
+ */
+int
+main(void)
+{
+	libcoopgamma_filter_t filter;
+	size_t i, j, max_size;
+
+	max_size = sizes[0];
+	for (j = 1; j < sizeof(sizes) / sizeof(*sizes); j++)
+		if (sizes[j] > max_size)
+			max_size = sizes[j];
+	filter.ramps.d.red = malloc(max_size * sizeof(*filter.ramps.d.red));
+	if (!filter.ramps.d.red)
+		goto fail;
+	filter.ramps.u8.green_size = filter.ramps.u8.blue_size = 0;
+	filter.ramps.u8.green = filter.ramps.u8.blue = NULL;
+
+	printf("/* Generated by cg-bake, do not edit */\n");
+	printf("#include \"cg-kernel.h\"\n");
+
+	for (i = 0; i < sizeof(curves) / sizeof(*curves); i++) {
+		for (j = 0; j < sizeof(sizes) / sizeof(*sizes); j++) {
+			filter.ramps.u8.red_size = sizes[j];
+#define X(CONST, MEMBER, MAX, TYPE)\
+			filter.depth = CONST;\
+			calculate(&filter, curves[i].curve);\
+			printf("\nstatic const " #TYPE " %s_%zu_" #MEMBER "[] = {\n", curves[i].name, sizes[j]);\
+			print_stops(&filter);\
+			printf("};\n");
+			LIST_DEPTHS
+#undef X
+		}
+	}
+
+	printf("\nconst struct baked_table baked_tables[] = {\n");
+	for (i = 0; i < sizeof(curves) / sizeof(*curves); i++) {
+		for (j = 0; j < sizeof(sizes) / sizeof(*sizes); j++) {
+#define X(CONST, MEMBER, MAX, TYPE)\
+			printf("\t{%s, %zu, " #CONST ", %s_%zu_" #MEMBER "},\n",\
+			       curves[i].constant, sizes[j], curves[i].name, sizes[j]);
+			LIST_DEPTHS
+#undef X
+		}
+	}
+	printf("};\n");
+	printf("\nconst size_t baked_tables_n = sizeof(baked_tables) / sizeof(*baked_tables);\n");
+
+	free(filter.ramps.d.red);
+	if (fflush(stdout) || ferror(stdout))
+		goto fail;
+	return 0;
+
+fail:
+	perror("cg-bake");
+	return 1;
+}
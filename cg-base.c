@@ -1,16 +1,26 @@
 /* See LICENSE file for copyright and license details. */
 #include "cg-base.h"
+#include "cg-cache.h"
+#include "cg-event.h"
+#include "cg-pipeline.h"
 
 #include <libclut.h>
 
+#include <sys/epoll.h>
+#include <sys/stat.h>
 #include <alloca.h>
+#include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <inttypes.h>
 #include <poll.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 
 
 
@@ -50,21 +60,170 @@ size_t crtcs_n = 0;
  */
 size_t filters_n = 0;
 
+/**
+ * -x: remove filter rather than adding it
+ */
+int remove_mode = 0;
+
+/**
+ * -C: cache filled gamma ramps on disk
+ */
+int ramp_cache = 0;
+
+/**
+ * The number of frames per second `animate` shall render
+ */
+double frame_rate = DEFAULT_FRAME_RATE;
+
+
+/**
+ * The value of `struct crtc_cache_header.magic`
+ */
+#define CRTC_CACHE_MAGIC UINT64_C(0x6367437274634931)
+
+/**
+ * The value of `struct ramp_cache_header.magic`
+ */
+#define RAMP_CACHE_MAGIC UINT64_C(0x6367526d70734331)
+
+/**
+ * The prefix of the names of the files in the ramp cache
+ */
+#define RAMP_CACHE_PREFIX "ramps-"
+
+/**
+ * The size, in bytes, the ramp cache is
+ * trimmed to when files are added to it
+ */
+#ifndef RAMP_CACHE_LIMIT
+# define RAMP_CACHE_LIMIT ((uintmax_t)16 << 20)
+#endif
+
+/**
+ * The maximum number of threads `fill_filters` uses
+ */
+#define FILL_MAX_THREADS 8
+
+/**
+ * The number of gamma ramp stops, over all filters,
+ * `fill_filters` requires per thread it uses
+ */
+#define FILL_STOPS_PER_THREAD 8192
+
+
+
+/**
+ * Queue of requests to the server
+ */
+static pipeline_t pipeline;
+
+/**
+ * The FIFO from which parameter updates are read
+ * in resident mode, -1 if not in resident mode
+ */
+static int resident_fd = -1;
+
+/**
+ * Event source for the connection to the server
+ */
+static event_source_t server_source;
+
+/**
+ * Event source for the resident mode FIFO
+ */
+static event_source_t fifo_source;
+
+/**
+ * Whether the resident mode FIFO has become readable
+ */
+static int fifo_ready = 0;
+
+/**
+ * -v: print statistics on exit
+ */
+static int print_stats = 0;
+
+/**
+ * The number of filter updates sent to the server
+ */
+static size_t updates_sent = 0;
+
+/**
+ * The number of filter updates not sent because
+ * the gamma ramps were unchanged
+ */
+static size_t updates_elided = 0;
+
+/**
+ * The number of times scratch ramps have been allocated
+ */
+static size_t scratch_allocations = 0;
+
+/**
+ * Storage for the stops of the scratch ramps,
+ * `scratch_stride` stops per filter
+ */
+static double *scratch_stops = NULL;
+
+/**
+ * The number of stops in `scratch_stops` per filter
+ */
+static size_t scratch_stride = 0;
+
+/**
+ * The scratch ramps, one per filter
+ */
+static libcoopgamma_rampsd_t *scratch = NULL;
+
+/**
+ * Whether the frame timer of `animate` has
+ * expired since the last frame was rendered
+ */
+static int frame_due = 0;
+
+/**
+ * The pathname of the CRTC information cache,
+ * `NULL` if CRTC information is not cached
+ */
+static char *crtc_cache_path = NULL;
+
+/**
+ * Whether `crtc_info` was loaded from the cache
+ */
+static int crtc_info_cached = 0;
+
+/**
+ * Whether a filter update failed, or the
+ * list of CRTC:s had changed, while `crtc_info`
+ * was loaded from the cache
+ */
+static int crtc_cache_stale = 0;
+
+/**
+ * Whether the CRTC:s were selected with -c, in
+ * which case the list of all CRTC:s is requested
+ * along with the first requests, to validate and
+ * to store the CRTC information cache
+ */
+static int verify_crtc_list = 0;
 
 /**
- * Contexts for asynchronous ramp updates
+ * The pathname, with a trailing slash, of the
+ * directory of the ramp cache, `NULL` if gamma
+ * ramps are not cached
  */
-static libcoopgamma_async_context_t *asyncs = NULL;
+static char *ramp_cache_dir = NULL;
 
 /**
- * The number of pending receives
+ * The number of filters filled from the ramp cache
  */
-static size_t pending_recvs = 0;
+static size_t ramp_cache_hits = 0;
 
 /**
- * Whether message must be flushed
+ * The number of filters looked up in the
+ * ramp cache but not found in it
  */
-static int flush_pending = 0;
+static size_t ramp_cache_misses = 0;
 
 
 
@@ -98,6 +257,12 @@ struct crtc_sort_data
 	 */
 	size_t blue_size;
 
+	/**
+	 * The group of the CRTC, CRTC:s in different
+	 * groups are not sorted as equal
+	 */
+	size_t group;
+
 	/**
 	 * The index of the CRTC
 	 */
@@ -105,6 +270,260 @@ struct crtc_sort_data
 };
 
 
+/**
+ * The header of the CRTC information cache, it is
+ * followed by `.count` instances of `struct crtc_cache_entry`
+ * and then by the names of the CRTC:s
+ */
+struct crtc_cache_header
+{
+	/**
+	 * `CRTC_CACHE_MAGIC`
+	 */
+	uint64_t magic;
+
+	/**
+	 * `sizeof(libcoopgamma_crtc_info_t)`
+	 */
+	uint64_t info_size;
+
+	/**
+	 * The device of the server's PID file
+	 */
+	uint64_t server_dev;
+
+	/**
+	 * The inode of the server's PID file
+	 */
+	uint64_t server_ino;
+
+	/**
+	 * The modification time, in seconds,
+	 * of the server's PID file
+	 */
+	int64_t server_sec;
+
+	/**
+	 * The nanoseconds of the modification
+	 * time of the server's PID file
+	 */
+	int64_t server_nsec;
+
+	/**
+	 * Hash of the list of all CRTC:s
+	 */
+	uint64_t crtcs_hash;
+
+	/**
+	 * The number of CRTC:s
+	 */
+	uint64_t count;
+};
+
+
+/**
+ * CRTC in the CRTC information cache
+ */
+struct crtc_cache_entry
+{
+	/**
+	 * The CRTC information
+	 */
+	libcoopgamma_crtc_info_t info;
+
+	/**
+	 * The offset of the CRTC's name in the file
+	 */
+	uint64_t name_offset;
+
+	/**
+	 * The length of the CRTC's name
+	 */
+	uint64_t name_length;
+};
+
+
+/**
+ * The header of a file in the ramp cache, it is
+ * followed by `.key_size` bytes of key, padding
+ * to a multiple of 8 bytes, and then the red,
+ * green, and blue gamma ramps
+ */
+struct ramp_cache_header
+{
+	/**
+	 * `RAMP_CACHE_MAGIC`
+	 */
+	uint64_t magic;
+
+	/**
+	 * The device of the program's executable
+	 */
+	uint64_t exe_dev;
+
+	/**
+	 * The inode of the program's executable
+	 */
+	uint64_t exe_ino;
+
+	/**
+	 * The size of the program's executable
+	 */
+	uint64_t exe_size;
+
+	/**
+	 * The modification time, in seconds,
+	 * of the program's executable
+	 */
+	int64_t exe_sec;
+
+	/**
+	 * The nanoseconds of the modification
+	 * time of the program's executable
+	 */
+	int64_t exe_nsec;
+
+	/**
+	 * The gamma ramp type
+	 */
+	int64_t depth;
+
+	/**
+	 * The size of the red gamma ramp
+	 */
+	uint64_t red_size;
+
+	/**
+	 * The size of the green gamma ramp
+	 */
+	uint64_t green_size;
+
+	/**
+	 * The size of the blue gamma ramp
+	 */
+	uint64_t blue_size;
+
+	/**
+	 * `FILL_SAME_CHANNELS` and `FILL_IDENTITY`,
+	 * as passed to `fill_cached_filters`
+	 */
+	uint64_t flags;
+
+	/**
+	 * The size of the key: the filter's
+	 * class, with its NUL byte, followed
+	 * by the parameters
+	 */
+	uint64_t key_size;
+};
+
+
+/**
+ * Work shared by the threads in `fill_filters`
+ */
+struct fill_job
+{
+	/**
+	 * The function that fills a filter
+	 */
+	fill_func_t *fill;
+
+	/**
+	 * The argument to pass to `.fill`
+	 */
+	void *data;
+
+	/**
+	 * Whether `FILL_SAME_CHANNELS` was used
+	 */
+	int same;
+
+	/**
+	 * Whether `FILL_IDENTITY` was used
+	 */
+	int identity;
+
+	/**
+	 * `FILL_SAME_CHANNELS` and `FILL_IDENTITY`
+	 * if they were used
+	 */
+	int flags;
+
+	/**
+	 * The parameters the gamma ramps are calculated
+	 * from, `NULL` if the ramp cache is not used
+	 */
+	const void *params;
+
+	/**
+	 * The size of `.params`
+	 */
+	size_t params_size;
+
+	/**
+	 * The indices, in `crtc_updates`,
+	 * of the filters to fill
+	 */
+	size_t *indices;
+
+	/**
+	 * The return value of `.fill` for
+	 * each filter in `.indices`
+	 */
+	int *results;
+
+	/**
+	 * The value of `errno` for each filter
+	 * in `.indices` for which `.fill` failed
+	 */
+	int *errnos;
+
+	/**
+	 * The number of elements in `.indices`
+	 */
+	size_t n;
+
+	/**
+	 * The next element in `.indices` to fill
+	 */
+	size_t next;
+
+	/**
+	 * The number of filters filled from the ramp cache
+	 */
+	size_t hits;
+
+	/**
+	 * The number of filters not found in the ramp cache
+	 */
+	size_t misses;
+
+	/**
+	 * Whether any file was added to the ramp cache
+	 */
+	int stored;
+
+	/**
+	 * Mutex protecting `.next`, `.hits`,
+	 * `.misses`, and `.stored`
+	 */
+	pthread_mutex_t mutex;
+};
+
+
+/**
+ * The expected header of the CRTC information cache,
+ * `.count` is not used
+ */
+static struct crtc_cache_header crtc_cache_key;
+
+/**
+ * The part of the header of the files in the ramp
+ * cache that is the same for all files
+ */
+static struct ramp_cache_header ramp_cache_key;
+
+
 
 /**
  * Compare two strings
@@ -137,6 +556,37 @@ crtc_sort_data_cmp(const void *a_, const void *b_)
 }
 
 
+/**
+ * Allocate the gamma ramps of a filter unless
+ * they have already been allocated, and optionally
+ * reset them to identity ramps
+ * 
+ * @param   index     The index of the filter in `crtc_updates`
+ * @param   identity  Whether to reset the gamma ramps
+ * @return            Zero on success, -1 on error
+ */
+static int
+prepare_ramps(size_t index, int identity)
+{
+	libcoopgamma_filter_t *filter = &crtc_updates[index].filter;
+	int allocated = !!filter->ramps.u8.red;
+	switch (filter->depth) {
+#define X(CONST, MEMBER, MAX, TYPE)\
+	case CONST:\
+		if (!allocated && libcoopgamma_ramps_initialise(&filter->ramps.MEMBER) < 0)\
+			return -1;\
+		if (identity)\
+			libclut_start_over(&filter->ramps.MEMBER, MAX, TYPE, 1, 1, 1);\
+		break;
+	LIST_DEPTHS
+#undef X
+	default:
+		abort();
+	}
+	return 0;
+}
+
+
 /**
  * Make elements in `crtc_updates` slaves where appropriate
  * 
@@ -144,6 +594,21 @@ crtc_sort_data_cmp(const void *a_, const void *b_)
  */
 int
 make_slaves(void)
+{
+	return make_grouped_slaves(NULL);
+}
+
+
+/**
+ * Make elements in `crtc_updates` slaves where appropriate,
+ * but only make filters slaves of filters in the same group
+ * 
+ * @param   groups  The group of each element in `crtc_updates`,
+ *                  `NULL` if all elements are in the same group
+ * @return          Zero on success, -1 on error
+ */
+int
+make_grouped_slaves(const size_t *groups)
 {
 	struct crtc_sort_data *data;
 	size_t i, j, n = 0, master = 0, master_i;
@@ -158,6 +623,7 @@ make_slaves(void)
 		data[n].red_size   = crtc_updates[i].filter.ramps.u8.red_size;
 		data[n].green_size = crtc_updates[i].filter.ramps.u8.green_size;
 		data[n].blue_size  = crtc_updates[i].filter.ramps.u8.blue_size;
+		data[n].group      = groups ? groups[i] : 0;
 		data[n].index      = i;
 		n++;
 	}
@@ -179,7 +645,8 @@ make_slaves(void)
 			master = i;
 			master_i = data[master].index;
 		} else {
-			libcoopgamma_ramps_destroy(&crtc_updates[data[i].index].filter.ramps.u8);
+			if (prepare_ramps(master_i, 0) < 0)
+				return -1;
 			crtc_updates[data[i].index].master = 0;
 			crtc_updates[data[i].index].filter.ramps.u8 = crtc_updates[master_i].filter.ramps.u8;
 		}
@@ -198,128 +665,1220 @@ make_slaves(void)
 
 
 /**
- * Update a filter and synchronise calls
+ * Make master elements in `crtc_updates` that only
+ * differ in gamma ramp type (or also in gamma ramp
+ * size if `resample` is non-zero) share computation:
+ * `fill_filters` fills one of them in double precision
+ * and translates the result to the others
  * 
- * @param   index    The index of the CRTC
- * @param   timeout  The number of milliseconds a call to `poll` may block,
- *                   -1 if it may block forever
- * @return           1: Success, no pending synchronisations
- *                   0: Success, with still pending synchronisations
- *                   -1: Error, `errno` set
- *                   -2: Error, `cg.error` set
+ * This shall be called after `make_slaves`, and only
+ * if the fill function's transformation is independent
+ * of the gamma ramp type, and, if `resample` is non-zero,
+ * of the gamma ramp size; the fill function must start
+ * from the identity ramp
  * 
- * @throws  EINTR   Call to `poll` was interrupted by a signal
- * @throws  EAGAIN  Call to `poll` timed out
+ * @param   resample  Whether filters with different gamma ramp
+ *                    sizes shall share computation, the ramps
+ *                    are then resampled, by linear interpolation,
+ *                    from the largest ramps, so they are not exact
+ *                    and this shall only be used when approximate
+ *                    ramps have been asked for
+ * @return            Zero on success, -1 on error
  */
 int
-update_filter(size_t index, int timeout)
+make_peers(int resample)
+{
+	struct crtc_sort_data *data;
+	size_t i, j, k, n = 0, leader, size, leader_size;
+
+	data = alloca(filters_n * sizeof(*data));
+	memset(data, 0, filters_n * sizeof(*data));
+	for (i = 0; i < filters_n; i++) {
+		if (!crtc_updates[i].master || !crtc_info[crtc_updates[i].crtc].supported)
+			continue;
+		if (!resample) {
+			data[n].red_size   = crtc_updates[i].filter.ramps.u8.red_size;
+			data[n].green_size = crtc_updates[i].filter.ramps.u8.green_size;
+			data[n].blue_size  = crtc_updates[i].filter.ramps.u8.blue_size;
+		}
+		data[n].index = i;
+		n++;
+	}
+
+	qsort(data, n, sizeof(*data), crtc_sort_data_cmp);
+
+	for (i = 0; i < n; i = j) {
+		for (j = i + 1; j < n; j++)
+			if (memcmp(data + i, data + j, sizeof(*data) - sizeof(data->index)))
+				break;
+		if (j - i < 2)
+			continue;
+
+		leader = data[i].index;
+		leader_size = 0;
+		for (k = i; k < j; k++) {
+			size  = crtc_updates[data[k].index].filter.ramps.u8.red_size;
+			size += crtc_updates[data[k].index].filter.ramps.u8.green_size;
+			size += crtc_updates[data[k].index].filter.ramps.u8.blue_size;
+			if (size > leader_size) {
+				leader = data[k].index;
+				leader_size = size;
+			}
+		}
+
+		crtc_updates[leader].peers = malloc((j - i - 1) * sizeof(size_t));
+		if (!crtc_updates[leader].peers)
+			return -1;
+		for (k = i; k < j; k++) {
+			if (data[k].index == leader)
+				continue;
+			crtc_updates[leader].peers[crtc_updates[leader].peers_n++] = data[k].index;
+			crtc_updates[data[k].index].peer = 1;
+		}
+	}
+
+	return reserve_scratch();
+}
+
+
+/**
+ * Send a filter update
+ * 
+ * @param   ctx    The libcoopgamma context
+ * @param   index  The index of the filter in `crtc_updates`
+ * @param   async  Output parameter for the asynchronous call context
+ * @return         Zero on success, -1 on error
+ */
+static int
+send_filter(libcoopgamma_context_t *ctx, size_t index, libcoopgamma_async_context_t *async)
+{
+	crtc_updates[index].stale = 0;
+	updates_sent += 1;
+	return libcoopgamma_set_gamma_send(&crtc_updates[index].filter, ctx, async);
+}
+
+
+static int submit_filter(size_t index);
+
+
+/**
+ * Receive the response for a filter update,
+ * server-side errors are stored in the filter,
+ * and the filter is sent again if it is stale
+ * 
+ * @param   ctx    The libcoopgamma context
+ * @param   index  The index of the filter in `crtc_updates`
+ * @param   async  The asynchronous call context
+ * @return         Zero on success, -1 on error, -2
+ *                 on libcoopgamma error
+ */
+static int
+recv_filter(libcoopgamma_context_t *ctx, size_t index, libcoopgamma_async_context_t *async)
+{
+	crtc_updates[index].synced = 1;
+	if (libcoopgamma_set_gamma_recv(ctx, async) < 0) {
+		if (!ctx->error.server_side)
+			return -2;
+		crtc_updates[index].error = ctx->error;
+		crtc_updates[index].failed = 1;
+		crtc_updates[index].stale = 0;
+		crtc_cache_stale |= crtc_info_cached;
+		memset(&ctx->error, 0, sizeof(ctx->error));
+	}
+	if (crtc_updates[index].stale)
+		return submit_filter(index);
+	return 0;
+}
+
+
+/**
+ * Filter update requests
+ */
+static const pipeline_kind_t filter_request = {&send_filter, &recv_filter};
+
+
+/**
+ * Submit a filter update, it is sent by `synchronise`
+ * 
+ * @param   index  The index of the filter in `crtc_updates`
+ * @return         0: Success, the update is pending
+ *                 -1: Error, `errno` set
+ */
+static int
+submit_filter(size_t index)
 {
 	filter_update_t *filter = crtc_updates + index;
 
 	if (!filter->synced || filter->failed)
 		abort();
 
-	pending_recvs += 1;
+	if (pipeline_submit(&pipeline, &filter_request, index) < 0)
+		return -1;
 
-	if (libcoopgamma_set_gamma_send(&filter->filter, &cg, asyncs + index) < 0) {
-		switch (errno) {
-		case EINTR:
-		case EAGAIN:
-#if EAGAIN != EWOULDBLOCK
-		case EWOULDBLOCK:
-#endif
-			flush_pending = 1;
+	filter->synced = 0;
+	return 0;
+}
+
+
+/**
+ * Submit a filter update, it is sent by `synchronise`
+ * 
+ * @param   index  The index of the CRTC
+ * @return         0: Success, the update is pending
+ *                 -1: Error, `errno` set
+ */
+int
+update_filter(size_t index)
+{
+	crtc_updates[index].hashed = 0;
+	return submit_filter(index);
+}
+
+
+/**
+ * Calculate the hash of the gamma ramps of a filter
+ * 
+ * @param   filter  The filter
+ * @return          The hash of the filter's gamma ramps
+ */
+static uint64_t
+hash_ramps(const libcoopgamma_filter_t *filter)
+{
+	size_t size;
+
+	size  = filter->ramps.u8.red_size;
+	size += filter->ramps.u8.green_size;
+	size += filter->ramps.u8.blue_size;
+	switch (filter->depth) {
+#define X(CONST, MEMBER, MAX, TYPE)\
+	case CONST:\
+		size *= sizeof(TYPE);\
+		break;
+	LIST_DEPTHS
+#undef X
+	default:
+		abort();
+	}
+
+	/* The stops of all channels are allocated as one block */
+	return cache_hash(filter->ramps.u8.red, size, CACHE_HASH_INIT);
+}
+
+
+/**
+ * Submit a filter update unless one is already pending,
+ * in which case only the latest gamma ramps are sent
+ * 
+ * @param   index  The index of the CRTC
+ * @return         0: Success
+ *                 -1: Error, `errno` set
+ */
+int
+refresh_filter(size_t index)
+{
+	filter_update_t *filter = crtc_updates + index;
+	uint64_t hash;
+
+	if (filter->failed)
+		return 0;
+
+	hash = hash_ramps(&filter->filter);
+	if (filter->hashed && filter->hash == hash) {
+		updates_elided += 1;
+		return 0;
+	}
+	filter->hash = hash;
+	filter->hashed = 1;
+
+	if (filter->synced)
+		return submit_filter(index);
+	filter->stale = 1;
+	return 0;
+}
+
+
+/**
+ * Translate double-precision gamma ramps
+ * into the gamma ramps of a filter
+ * 
+ * @param  filter  The filter
+ * @param  ramps   The double-precision gamma ramps
+ */
+static void
+translate_ramps(libcoopgamma_filter_t *filter, const libcoopgamma_rampsd_t *ramps)
+{
+	switch (filter->depth) {
+#define X(CONST, MEMBER, MAX, TYPE)\
+	case CONST:\
+		libclut_translate(&filter->ramps.MEMBER, MAX, TYPE, ramps, (double)1, double);\
+		break;
+	LIST_DEPTHS
+#undef X
+	default:
+		abort();
+	}
+}
+
+
+/**
+ * Get the size of a stop in a gamma ramp
+ * 
+ * @param   depth  The gamma ramp type
+ * @return         The size of a stop, in bytes
+ */
+static size_t
+stop_width(libcoopgamma_depth_t depth)
+{
+	switch (depth) {
+#define X(CONST, MEMBER, MAX, TYPE)\
+	case CONST:\
+		return sizeof(TYPE);
+	LIST_DEPTHS
+#undef X
+	default:
+		abort();
+	}
+}
+
+
+/**
+ * Fill a filter, if `same_channels` is non-zero
+ * and the filter's channels are of the same size,
+ * only the red channel is filled, and it is then
+ * copied to the green and blue channels
+ * 
+ * @param   fill           Function that fills a filter
+ * @param   index          The index of the filter in `crtc_updates`
+ * @param   data           Argument passed to `fill`
+ * @param   same_channels  Whether `FILL_SAME_CHANNELS` was used
+ * @return                 The value returned by `fill`
+ */
+static int
+fill_channels(fill_func_t *fill, size_t index, void *data, int same_channels)
+{
+	libcoopgamma_filter_t *filter = &crtc_updates[index].filter;
+	size_t n = filter->ramps.u8.red_size, width;
+	int r;
+
+	if (!same_channels || filter->ramps.u8.green_size != n || filter->ramps.u8.blue_size != n)
+		return fill(index, data);
+
+	filter->ramps.u8.green_size = filter->ramps.u8.blue_size = 0;
+	r = fill(index, data);
+	filter->ramps.u8.green_size = filter->ramps.u8.blue_size = n;
+	if (r)
+		return r;
+
+	width = stop_width(filter->depth);
+	memcpy(filter->ramps.u8.green, filter->ramps.u8.red, n * width);
+	memcpy(filter->ramps.u8.blue,  filter->ramps.u8.red, n * width);
+	return 0;
+}
+
+
+/**
+ * Fill a filter, and if it has peers, fill it
+ * in double precision in its scratch ramps and
+ * translate the result to it and its peers
+ * 
+ * @param   fill           Function that fills a filter
+ * @param   index          The index of the filter in `crtc_updates`
+ * @param   data           Argument passed to `fill`
+ * @param   same_channels  Whether `FILL_SAME_CHANNELS` was used
+ * @param   identity       Whether `FILL_IDENTITY` was used
+ * @return                 The value returned by `fill`, or -1 if
+ *                         the gamma ramps could not be allocated
+ */
+static int
+fill_shared(fill_func_t *fill, size_t index, void *data, int same_channels, int identity)
+{
+	filter_update_t *update = &crtc_updates[index];
+	libcoopgamma_depth_t depth = update->filter.depth;
+	union libcoopgamma_ramps ramps;
+	libcoopgamma_rampsd_t *scratch;
+	size_t i;
+	int r;
+
+	if (prepare_ramps(index, identity && !update->peers_n) < 0)
+		return -1;
+	if (!update->peers_n)
+		return fill_channels(fill, index, data, same_channels);
+
+	/* Saved after `prepare_ramps`, which may allocate them */
+	ramps = update->filter.ramps;
+	scratch = scratch_ramps(index);
+	libclut_start_over(scratch, (double)1, double, 1, 1, 1);
+	update->filter.depth = LIBCOOPGAMMA_DOUBLE;
+	update->filter.ramps.d = *scratch;
+	r = fill_channels(fill, index, data, same_channels);
+	update->filter.depth = depth;
+	update->filter.ramps = ramps;
+	if (r)
+		return r;
+
+	translate_ramps(&update->filter, scratch);
+	for (i = 0; i < update->peers_n; i++) {
+		if (prepare_ramps(update->peers[i], 0) < 0)
+			return -1;
+		translate_ramps(&crtc_updates[update->peers[i]].filter, scratch);
+	}
+	return 0;
+}
+
+
+/**
+ * Submit a filter and its slaves
+ * 
+ * @param   submit  `update_filter` or `refresh_filter`
+ * @param   index   The index of the filter in `crtc_updates`
+ * @return          0: Success
+ *                  -1: Error, `errno` set
+ */
+static int
+submit_with_slaves(int (*submit)(size_t), size_t index)
+{
+	size_t i;
+	if (submit(index) < 0)
+		return -1;
+	if (crtc_updates[index].slaves)
+		for (i = 0; crtc_updates[index].slaves[i]; i++)
+			if (submit(crtc_updates[index].slaves[i]) < 0)
+				return -1;
+	return 0;
+}
+
+
+/**
+ * Get the header, key, and pathname of the
+ * file in the ramp cache for a filter
+ * 
+ * @param   index   The index of the filter in `crtc_updates`
+ * @param   job     The job the filter is filled in
+ * @param   header  Output parameter for the header of the file
+ * @param   keyp    Output parameter for the key, shall be
+ *                  freed by the caller unless `NULL` is returned
+ * @return          The pathname of the file, shall be freed
+ *                  by the caller, `NULL` on error
+ */
+static char *
+ramp_cache_entry(size_t index, const struct fill_job *job, struct ramp_cache_header *header, char **keyp)
+{
+	const libcoopgamma_filter_t *filter = &crtc_updates[index].filter;
+	size_t class_size = strlen(filter->class) + 1;
+	char name[sizeof(RAMP_CACHE_PREFIX) + 16], *path;
+	uint64_t hash;
+
+	*header = ramp_cache_key;
+	header->depth      = (int64_t)filter->depth;
+	header->red_size   = (uint64_t)filter->ramps.u8.red_size;
+	header->green_size = (uint64_t)filter->ramps.u8.green_size;
+	header->blue_size  = (uint64_t)filter->ramps.u8.blue_size;
+	header->flags      = (uint64_t)job->flags;
+	header->key_size   = (uint64_t)(class_size + job->params_size);
+
+	*keyp = malloc(class_size + job->params_size);
+	if (!*keyp)
+		return NULL;
+	memcpy(*keyp, filter->class, class_size);
+	memcpy(*keyp + class_size, job->params, job->params_size);
+
+	hash = cache_hash(header, sizeof(*header), CACHE_HASH_INIT);
+	hash = cache_hash(*keyp, class_size + job->params_size, hash);
+	sprintf(name, RAMP_CACHE_PREFIX "%016" PRIx64, hash);
+
+	path = malloc(strlen(ramp_cache_dir) + sizeof(name));
+	if (!path) {
+		free(*keyp);
+		return NULL;
+	}
+	stpcpy(stpcpy(path, ramp_cache_dir), name);
+	return path;
+}
+
+
+/**
+ * Fill a filter from the ramp cache
+ * 
+ * @param   index  The index of the filter in `crtc_updates`
+ * @param   job    The job the filter is filled in
+ * @return         1 if the filter was filled, 0 if it is
+ *                 not in the cache or on error
+ */
+static int
+load_cached_ramps(size_t index, const struct fill_job *job)
+{
+	libcoopgamma_filter_t *filter = &crtc_updates[index].filter;
+	struct ramp_cache_header header;
+	size_t size, offset, stops;
+	char *data, *key, *path;
+	int ret = 0;
+
+	path = ramp_cache_entry(index, job, &header, &key);
+	if (!path)
+		return 0;
+	data = cache_map(path, &size);
+	if (!data)
+		goto out;
+
+	offset = (sizeof(header) + (size_t)header.key_size + 7) & ~(size_t)7;
+	stops = filter->ramps.u8.red_size + filter->ramps.u8.green_size + filter->ramps.u8.blue_size;
+	if (size == offset + stops * stop_width(filter->depth) &&
+	    !memcmp(data, &header, sizeof(header)) &&
+	    !memcmp(data + sizeof(header), key, (size_t)header.key_size) &&
+	    !prepare_ramps(index, 0)) {
+		/* The channels are allocated in one block, in order */
+		memcpy(filter->ramps.u8.red, data + offset, size - offset);
+		cache_touch(path);
+		ret = 1;
+	}
+
+	cache_unmap(data, size);
+out:
+	free(key);
+	free(path);
+	return ret;
+}
+
+
+/**
+ * Add a filter to the ramp cache, failure is ignored
+ * 
+ * @param   index  The index of the filter in `crtc_updates`
+ * @param   job    The job the filter is filled in
+ * @return         1 if the filter was added, 0 otherwise
+ */
+static int
+save_cached_ramps(size_t index, const struct fill_job *job)
+{
+	const libcoopgamma_filter_t *filter = &crtc_updates[index].filter;
+	struct ramp_cache_header header;
+	size_t size, offset, stops;
+	char *data, *key, *path;
+	int ret = 0;
+
+	path = ramp_cache_entry(index, job, &header, &key);
+	if (!path)
+		return 0;
+
+	offset = (sizeof(header) + (size_t)header.key_size + 7) & ~(size_t)7;
+	stops = filter->ramps.u8.red_size + filter->ramps.u8.green_size + filter->ramps.u8.blue_size;
+	size = offset + stops * stop_width(filter->depth);
+	data = calloc(1, size);
+	if (data) {
+		memcpy(data, &header, sizeof(header));
+		memcpy(data + sizeof(header), key, (size_t)header.key_size);
+		memcpy(data + offset, filter->ramps.u8.red, size - offset);
+		ret = !cache_write(path, data, size);
+		free(data);
+	}
+
+	free(key);
+	free(path);
+	return ret;
+}
+
+
+/**
+ * Fill a filter, and its peers, from the ramp cache,
+ * or fill it with `fill_shared` and add it, and its
+ * peers, to the ramp cache
+ * 
+ * @param   job    The job the filter is filled in
+ * @param   index  The index of the filter in `crtc_updates`
+ * @return         The value returned by `fill_shared`,
+ *                 0 if filled from the cache
+ */
+static int
+fill_cached(struct fill_job *job, size_t index)
+{
+	filter_update_t *update = &crtc_updates[index];
+	size_t i, n = update->peers_n + 1;
+	int r, stored = 0;
+
+	if (load_cached_ramps(index, job)) {
+		for (i = 0; i < update->peers_n; i++)
+			if (!load_cached_ramps(update->peers[i], job))
+				break;
+		if (i == update->peers_n) {
+			pthread_mutex_lock(&job->mutex);
+			job->hits += n;
+			pthread_mutex_unlock(&job->mutex);
+			return 0;
+		}
+	}
+
+	r = fill_shared(job->fill, index, job->data, job->same, job->identity);
+	if (!r) {
+		stored |= save_cached_ramps(index, job);
+		for (i = 0; i < update->peers_n; i++)
+			stored |= save_cached_ramps(update->peers[i], job);
+	}
+
+	pthread_mutex_lock(&job->mutex);
+	job->misses += n;
+	job->stored |= stored;
+	pthread_mutex_unlock(&job->mutex);
+	return r;
+}
+
+
+/**
+ * Fill filters until all filters in a job are taken
+ * 
+ * @param   arg  The job, `struct fill_job *`
+ * @return       `NULL`
+ */
+static void *
+fill_worker(void *arg)
+{
+	struct fill_job *job = arg;
+	size_t i;
+
+	for (;;) {
+		pthread_mutex_lock(&job->mutex);
+		i = job->next++;
+		pthread_mutex_unlock(&job->mutex);
+		if (i >= job->n)
 			break;
-		default:
+		if (job->params)
+			job->results[i] = fill_cached(job, job->indices[i]);
+		else
+			job->results[i] = fill_shared(job->fill, job->indices[i], job->data, job->same, job->identity);
+		if (job->results[i] < 0)
+			job->errnos[i] = errno;
+	}
+
+	return NULL;
+}
+
+
+/**
+ * Fill the filters in a job, in as many threads
+ * as the number of stops in the filters warrant
+ * 
+ * @param   job  The job, all members but `.next`, `.hits`,
+ *               `.misses`, `.stored`, and `.mutex` must be set
+ * @return       0: Success
+ *               -1: Error, `errno` set
+ */
+static int
+run_fill_job(struct fill_job *job)
+{
+	pthread_t threads[FILL_MAX_THREADS - 1];
+	size_t i, index, stops = 0, max_threads, threads_n = 0;
+	long cpus;
+
+	job->next   = 0;
+	job->hits   = 0;
+	job->misses = 0;
+	job->stored = 0;
+	for (i = 0; i < job->n; i++) {
+		index = job->indices[i];
+		stops += crtc_updates[index].filter.ramps.u8.red_size;
+		stops += crtc_updates[index].filter.ramps.u8.green_size;
+		stops += crtc_updates[index].filter.ramps.u8.blue_size;
+	}
+
+	max_threads = stops / FILL_STOPS_PER_THREAD;
+	cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (cpus > 0 && max_threads > (size_t)cpus)
+		max_threads = (size_t)cpus;
+	if (max_threads > job->n)
+		max_threads = job->n;
+	if (max_threads > FILL_MAX_THREADS)
+		max_threads = FILL_MAX_THREADS;
+
+	if ((errno = pthread_mutex_init(&job->mutex, NULL)))
+		return -1;
+	/* If a thread cannot be created, the remaining threads do its work */
+	for (; threads_n + 1 < max_threads; threads_n++)
+		if (pthread_create(&threads[threads_n], NULL, &fill_worker, job))
+			break;
+	fill_worker(job);
+	while (threads_n--)
+		pthread_join(threads[threads_n], NULL);
+	pthread_mutex_destroy(&job->mutex);
+
+	ramp_cache_hits += job->hits;
+	ramp_cache_misses += job->misses;
+	if (job->stored)
+		cache_evict(ramp_cache_dir, RAMP_CACHE_PREFIX, RAMP_CACHE_LIMIT);
+
+	for (i = 0; i < job->n; i++) {
+		if (job->results[i] < 0) {
+			errno = job->errnos[i];
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+
+static int verify_crtc_info(struct fill_job *job, int (*submit)(size_t));
+
+
+/**
+ * Fill the master filters of all supported CRTC:s,
+ * and optionally submit them and their slaves
+ * 
+ * @param   fill   Function that fills a filter
+ * @param   data   Argument passed to `fill`
+ * @param   flags  0, `FILL_UPDATE`, or `FILL_REFRESH`, optionally
+ *                 OR:ed with `FILL_SAME_CHANNELS` and `FILL_IDENTITY`
+ * @return         0: Success
+ *                 -1: Error, `errno` set
+ *                 -2: Error, `cg.error` set
+ */
+int
+fill_filters(fill_func_t *fill, void *data, int flags)
+{
+	return fill_cached_filters(fill, data, flags, NULL, 0);
+}
+
+
+/**
+ * Fill the master filters of all supported CRTC:s,
+ * and optionally submit them and their slaves, as
+ * `fill_filters` does, but if `ramp_cache` is set,
+ * the gamma ramps are first looked up in the cache,
+ * and filled gamma ramps are added to the cache
+ * 
+ * @param   fill         Function that fills a filter
+ * @param   data         Argument passed to `fill`
+ * @param   flags        0, `FILL_UPDATE`, or `FILL_REFRESH`, optionally
+ *                       OR:ed with `FILL_SAME_CHANNELS` and `FILL_IDENTITY`
+ * @param   params       The parameters the gamma ramps are calculated from,
+ *                       must not contain padding
+ * @param   params_size  The size of `params`
+ * @return               0: Success
+ *                       -1: Error, `errno` set
+ *                       -2: Error, `cg.error` set
+ */
+int
+fill_cached_filters(fill_func_t *fill, void *data, int flags, const void *params, size_t params_size)
+{
+	struct fill_job job;
+	size_t i, j, index;
+	int (*submit)(size_t) = (flags & FILL_REFRESH) ? &refresh_filter : &update_filter;
+
+	job.fill     = fill;
+	job.data     = data;
+	job.same     = !!(flags & FILL_SAME_CHANNELS);
+	job.identity = !!(flags & FILL_IDENTITY);
+	job.flags    = flags & (FILL_SAME_CHANNELS | FILL_IDENTITY);
+	job.params   = ramp_cache_dir ? params : NULL;
+	job.params_size = params_size;
+	job.indices  = alloca(filters_n * sizeof(*job.indices));
+	job.results  = alloca(filters_n * sizeof(*job.results));
+	job.errnos   = alloca(filters_n * sizeof(*job.errnos));
+	job.n        = 0;
+	for (i = 0; i < filters_n; i++)
+		if (crtc_updates[i].master && !crtc_updates[i].peer && crtc_info[crtc_updates[i].crtc].supported)
+			job.indices[job.n++] = i;
+
+	if (run_fill_job(&job) < 0)
+		return -1;
+
+	if (!(flags & (FILL_UPDATE | FILL_REFRESH)))
+		return 0;
+
+	for (i = 0; i < job.n; i++) {
+		if (job.results[i])
+			continue;
+		index = job.indices[i];
+		if (submit_with_slaves(submit, index) < 0)
 			return -1;
+		for (j = 0; j < crtc_updates[index].peers_n; j++)
+			if (submit_with_slaves(submit, crtc_updates[index].peers[j]) < 0)
+				return -1;
+	}
+
+	if (crtc_info_cached)
+		return verify_crtc_info(&job, submit);
+	return 0;
+}
+
+
+/**
+ * Allocate the scratch gamma ramps used by `scratch_ramps`
+ * 
+ * The scratch ramps are allocated in one block, sized for
+ * the largest CRTC, the first time the function is called,
+ * later calls do nothing; this shall be called before
+ * `fill_filters` is called with a function that uses
+ * `scratch_ramps`
+ * 
+ * @return  Zero on success, -1 on error
+ */
+int
+reserve_scratch(void)
+{
+	size_t i, n;
+
+	if (scratch)
+		return 0;
+
+	for (i = 0; i < filters_n; i++) {
+		n  = crtc_updates[i].filter.ramps.u8.red_size;
+		n += crtc_updates[i].filter.ramps.u8.green_size;
+		n += crtc_updates[i].filter.ramps.u8.blue_size;
+		if (n > scratch_stride)
+			scratch_stride = n;
+	}
+
+	scratch = calloc(filters_n + 1, sizeof(*scratch));
+	if (!scratch)
+		return -1;
+	scratch_stops = malloc((filters_n * scratch_stride + 1) * sizeof(double));
+	if (!scratch_stops) {
+		free(scratch);
+		scratch = NULL;
+		return -1;
+	}
+	scratch_allocations += 1;
+	return 0;
+}
+
+
+/**
+ * Get the scratch double-precision gamma ramps of a
+ * filter, for intermediate results in a `fill_func_t`
+ * 
+ * The ramps have the same sizes as the filter's ramps,
+ * their content is undefined; the scratch ramps of
+ * different filters do not overlap
+ * 
+ * @param   index  The index of the filter in `crtc_updates`
+ * @return         The scratch ramps, valid until the
+ *                 next call with the same index
+ */
+libcoopgamma_rampsd_t *
+scratch_ramps(size_t index)
+{
+	libcoopgamma_rampsd_t *ramps = &scratch[index];
+	ramps->red_size   = crtc_updates[index].filter.ramps.d.red_size;
+	ramps->green_size = crtc_updates[index].filter.ramps.d.green_size;
+	ramps->blue_size  = crtc_updates[index].filter.ramps.d.blue_size;
+	ramps->red   = &scratch_stops[index * scratch_stride];
+	ramps->green = &ramps->red[ramps->red_size];
+	ramps->blue  = &ramps->green[ramps->green_size];
+	return ramps;
+}
+
+
+/**
+ * Called when the connection to the server is ready
+ * 
+ * @param   source   `&server_source`
+ * @param   revents  The epoll events that occurred
+ * @return           Zero on success, -1 on error, -2
+ *                   on libcoopgamma error
+ * 
+ * @throws  ENOTRECOVERABLE  The connection was closed by the server, the
+ *                           connection will not be watched anymore
+ */
+static int
+server_ready(event_source_t *source, uint32_t revents)
+{
+	int r, saved_errno;
+
+	r = pipeline_handle(&pipeline,
+	                    ((revents & EPOLLIN)  ? POLLIN  : 0) |
+	                    ((revents & EPOLLPRI) ? POLLPRI : 0) |
+	                    ((revents & EPOLLOUT) ? POLLOUT : 0) |
+	                    ((revents & EPOLLERR) ? POLLERR : 0) |
+	                    ((revents & EPOLLHUP) ? POLLHUP : 0));
+	if (r == -1 && errno == ENOTRECOVERABLE) {
+		saved_errno = errno;
+		event_remove(source);
+		errno = saved_errno;
+	}
+	return r;
+}
+
+
+/**
+ * Send submitted requests, and wait for events
+ * and call their handlers
+ * 
+ * @param   timeout  The number of milliseconds the wait for events may
+ *                   block, -1 if it may block forever
+ * @return           Zero on success, -1 on error, -2 on libcoopgamma error
+ * 
+ * @throws  EINTR   The wait for events was interrupted by a signal
+ * @throws  EAGAIN  The wait for events timed out
+ */
+static int
+process_events(int timeout)
+{
+	if (pipeline_dispatch(&pipeline) < 0)
+		return -1;
+	if (event_modify(&server_source, pipeline.flush_pending ? EPOLLIN | EPOLLOUT : EPOLLIN) < 0)
+		return -1;
+	return event_wait(timeout);
+}
+
+
+/**
+ * Send pending updates and synchronise calls
+ * 
+ * @param   timeout  The number of milliseconds the wait for events may
+ *                   block, -1 if it may block forever
+ * @return           1: Success, no pending synchronisations
+ *                   0: Success, with still pending synchronisations
+ *                   -1: Error, `errno` set
+ *                   -2: Error, `cg.error` set
+ * 
+ * @throws  EINTR   The wait for events was interrupted by a signal
+ * @throws  EAGAIN  The wait for events timed out
+ */
+int
+synchronise(int timeout)
+{
+	int r;
+
+	if (pipeline_dispatch(&pipeline) < 0)
+		return -1;
+	if (!pipeline.inflight_n)
+		return 1;
+
+	if ((r = process_events(timeout)) < 0)
+		return r;
+
+	return !pipeline.inflight_n;
+}
+
+
+/**
+ * Print the errors of all failed filter updates
+ * and reset their state for another update
+ */
+static void
+report_failures(void)
+{
+	size_t filter_i;
+	const char *side, *crtc;
+	libcoopgamma_error_t *error;
+
+	for (filter_i = 0; filter_i < filters_n; filter_i++) {
+		if (!crtc_updates[filter_i].failed)
+			continue;
+		error = &crtc_updates[filter_i].error;
+		side = error->server_side ? "server" : "client";
+		crtc = crtc_updates[filter_i].filter.crtc;
+		if (error->custom) {
+			if (error->number && error->description) {
+				fprintf(stderr, "%s: %s-side error number %" PRIu64 " for CRTC %s: %s\n",
+				        argv0, side, error->number, crtc, error->description);
+			} else if (error->number) {
+				fprintf(stderr, "%s: %s-side error number %" PRIu64 " for CRTC %s\n",
+				        argv0, side, error->number, crtc);
+			} else if (error->description) {
+				fprintf(stderr, "%s: %s-side error for CRTC %s: %s\n",
+				        argv0, side, crtc, error->description);
+			}
+		} else if (error->description) {
+			fprintf(stderr, "%s: %s-side error for CRTC %s: %s\n",
+			        argv0, side, crtc, error->description);
+		} else {
+			fprintf(stderr, "%s: %s-side error for CRTC %s: %s\n",
+			        argv0, side, crtc, strerror((int)error->number));
+		}
+		libcoopgamma_error_destroy(error);
+		libcoopgamma_error_initialise(error);
+		crtc_updates[filter_i].failed = 0;
+	}
+}
+
+
+/**
+ * Apply a parameter update received in resident mode
+ * 
+ * @param   line  The received line, will be modified
+ * @return        Zero on success, -1 on error, -2
+ *                on libcoopgamma error
+ */
+static int
+apply_update(char *line)
+{
+	char **argv, *p;
+	int argc = 0, r;
+	size_t i, j;
+
+	for (p = line; *p; argc++) {
+		while (isspace((unsigned char)*p))
+			p++;
+		if (!*p)
+			break;
+		while (*p && !isspace((unsigned char)*p))
+			p++;
+	}
+	argv = alloca(((size_t)argc + 1) * sizeof(*argv));
+	for (argc = 0, p = line; *p;) {
+		while (isspace((unsigned char)*p))
+			*p++ = '\0';
+		if (!*p)
+			break;
+		argv[argc++] = p;
+		while (*p && !isspace((unsigned char)*p))
+			p++;
+	}
+	argv[argc] = NULL;
+
+	switch (handle_update(argc, argv)) {
+	case 0:
+		break;
+	case 1:
+		fprintf(stderr, "%s: ignoring invalid update\n", argv0);
+		return 0;
+	default:
+		return -1;
+	}
+
+	for (i = 0, r = 1; i < filters_n; i++) {
+		if (!crtc_updates[i].master || !crtc_info[crtc_updates[i].crtc].supported)
+			continue;
+		if ((r = update_filter(i)) < 0)
+			return r;
+		if (crtc_updates[i].slaves)
+			for (j = 0; crtc_updates[i].slaves[j]; j++)
+				if ((r = update_filter(crtc_updates[i].slaves[j])) < 0)
+					return r;
+	}
+
+	while (r != 1)
+		if ((r = synchronise(-1)) < 0)
+			return r;
+
+	report_failures();
+	return 0;
+}
+
+
+/**
+ * Called when the resident mode FIFO becomes readable,
+ * the FIFO is not watched again until it is rearmed
+ * 
+ * @param   source   `&fifo_source`
+ * @param   revents  The epoll events that occurred
+ * @return           Zero
+ */
+static int
+fifo_readable(event_source_t *source, uint32_t revents)
+{
+	(void) source;
+	(void) revents;
+	fifo_ready = 1;
+	return 0;
+}
+
+
+/**
+ * Read parameter updates from the resident mode FIFO
+ * and apply them until the connection to the server
+ * is lost
+ * 
+ * The initial filter updates must have been synchronised,
+ * their failures are reported, so that the filters can
+ * be updated again
+ * 
+ * @return  -1: Error, `errno` set
+ *          -2: Error, `cg.error` set
+ */
+static int
+serve_updates(void)
+{
+	char *buf = NULL, *line, *end;
+	size_t size = 0, len = 0, new_size;
+	ssize_t got;
+	void *new;
+	int r = -1, saved_errno;
+
+	report_failures();
+
+	fifo_source.fd = resident_fd;
+	fifo_source.events = EPOLLIN | EPOLLONESHOT;
+	fifo_source.handler = &fifo_readable;
+	if (event_add(&fifo_source) < 0)
+		return -1;
+
+	for (;;) {
+		if ((r = event_wait(-1)) < 0) {
+			if (r == -1 && errno == EINTR)
+				continue;
+			goto fail;
+		}
+
+		if (!fifo_ready)
+			continue;
+		fifo_ready = 0;
+		for (;;) {
+			if (len == size) {
+				new_size = size ? (size << 1) : 128;
+				new = realloc(buf, new_size);
+				if (!new)
+					goto fail;
+				buf = new;
+				size = new_size;
+			}
+			got = read(resident_fd, buf + len, size - len);
+			if (got <= 0)
+				break;
+			len += (size_t)got;
+		}
+		if (got < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+			goto fail;
+
+		for (line = buf; (end = memchr(line, '\n', len - (size_t)(line - buf))); line = end + 1) {
+			*end = '\0';
+			if ((r = apply_update(line)) < 0)
+				goto fail;
+		}
+		len -= (size_t)(line - buf);
+		memmove(buf, line, len);
+
+		if (event_modify(&fifo_source, EPOLLIN | EPOLLONESHOT) < 0)
+			goto fail;
+	}
+
+fail:
+	saved_errno = errno;
+	free(buf);
+	errno = saved_errno;
+	return r;
+}
+
+
+/**
+ * Keep the process alive until it is killed, or the
+ * connection to the server is lost, and apply received
+ * parameter updates if running in resident mode (-D)
+ * 
+ * This function never returns successfully
+ * 
+ * @return  -1: Error, `errno` set
+ *          -2: Error, `cg.error` set
+ */
+int
+stay_alive(void)
+{
+	int r;
+
+	if (resident_fd >= 0)
+		return serve_updates();
+
+	for (;;) {
+		if ((r = event_wait(-1)) < 0) {
+			if (r == -1 && errno == EINTR)
+				continue;
+			if (r == -1 && errno == ENOTRECOVERABLE)
+				break;
+			return r;
 		}
 	}
-  
-	filter->synced = 0;
-	return synchronise(timeout);
+
+	pause();
+	return -1;
 }
 
 
 /**
- * Synchronised calls
+ * Called when the frame timer of `animate` expires
  * 
- * @param   timeout  The number of milliseconds a call to `poll` may block,
- *                   -1 if it may block forever
- * @return           1: Success, no pending synchronisations
- *                   0: Success, with still pending synchronisations
+ * @param   source   The timer source
+ * @param   revents  The epoll events that occurred
+ * @return           Zero on success, -1 on error
+ */
+static int
+frame_timer_expired(event_source_t *source, uint32_t revents)
+{
+	int r;
+
+	(void) revents;
+	if ((r = event_read_timer(source)) < 0)
+		return -1;
+	frame_due |= r;
+	return 0;
+}
+
+
+/**
+ * Render frames at `frame_rate` frames per
+ * second until the last frame has been rendered
+ * 
+ * @param   frame    Function that submits the updates for a frame
+ * @param   data     Argument passed to `frame`
+ * @return           0: Success
  *                   -1: Error, `errno` set
  *                   -2: Error, `cg.error` set
- * 
- * @throws  EINTR   Call to `poll` was interrupted by a signal
- * @throws  EAGAIN  Call to `poll` timed out
+ *                   -3: Error, message already printed
  */
 int
-synchronise(int timeout)
+animate(int (*frame)(double elapsed, void *data), void *data)
 {
-	struct pollfd pollfd;
-	size_t selected;
-
-	pollfd.fd = cg.fd;
-	pollfd.events = POLLIN | POLLRDNORM | POLLRDBAND | POLLPRI;
-	if (flush_pending > 0)
-		pollfd.events |= POLLOUT;
-
-	pollfd.revents = 0;
-	if (poll(&pollfd, (nfds_t)1, timeout) < 0)
+	event_source_t timer;
+	struct timespec start, first, interval, now;
+	double period;
+	int r, last, saved_errno;
+
+	period = 1 / frame_rate;
+	interval.tv_sec  = (time_t)period;
+	interval.tv_nsec = (long)((period - (double)interval.tv_sec) * 1000000000L);
+	if (!interval.tv_sec && !interval.tv_nsec)
+		interval.tv_nsec = 1;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &start) < 0)
 		return -1;
-
-	if (pollfd.revents & (POLLOUT | POLLERR | POLLHUP | POLLNVAL)) {
-		if (libcoopgamma_flush(&cg) < 0)
-			goto sync;
-		flush_pending = 0;
+	first.tv_sec  = start.tv_sec  + interval.tv_sec;
+	first.tv_nsec = start.tv_nsec + interval.tv_nsec;
+	if (first.tv_nsec >= 1000000000L) {
+		first.tv_nsec -= 1000000000L;
+		first.tv_sec  += 1;
 	}
 
-	if (timeout < 0 && pending_recvs > 0) {
-		if (!(pollfd.revents & (POLLIN | POLLRDNORM | POLLRDBAND | POLLPRI))) {
-			pollfd.revents = 0;
-			if (poll(&pollfd, (nfds_t)1, -1) < 0)
-				return -1;
-		}
+	timer.handler = &frame_timer_expired;
+	if (event_timer(&timer, &first, &interval) < 0)
+		return -1;
+	if (event_add(&timer) < 0) {
+		r = -1;
+		goto out;
 	}
 
- sync:
-	if (pollfd.revents & (POLLIN | POLLRDNORM | POLLRDBAND | POLLPRI | POLLERR | POLLHUP | POLLNVAL)) {
-		for (;;) {
-			if (libcoopgamma_synchronise(&cg, asyncs, filters_n, &selected) < 0) {
-				if (!errno)
+	for (now = start;;) {
+		frame_due = 0;
+		last = frame((double)(now.tv_sec - start.tv_sec) +
+		             (double)(now.tv_nsec - start.tv_nsec) / 1000000000L, data);
+		if (last < 0) {
+			r = last;
+			goto out;
+		}
+		if (last)
+			break;
+		while (!frame_due) {
+			if ((r = process_events(-1)) < 0) {
+				if (r == -1 && errno == EINTR)
 					continue;
-				goto fail;
-			}
-			if (crtc_updates[selected].synced)
-				continue;
-			crtc_updates[selected].synced = 1;
-			pending_recvs -= 1;
-			if (libcoopgamma_set_gamma_recv(&cg, asyncs + selected) < 0) {
-				if (cg.error.server_side) {
-					crtc_updates[selected].error = cg.error;
-					crtc_updates[selected].failed = 1;
-					memset(&cg.error, 0, sizeof(cg.error));
-				} else {
-					goto cg_fail;
-				}
+				goto out;
 			}
 		}
+		if (clock_gettime(CLOCK_MONOTONIC, &now) < 0) {
+			r = -1;
+			goto out;
+		}
 	}
 
-	return !pending_recvs;
-cg_fail:
-	return -2;
-fail:
-	switch (errno) {
-	case EINTR:
-	case EAGAIN:
-#if EAGAIN != EWOULDBLOCK
-	case EWOULDBLOCK:
-#endif
-		return !pending_recvs;
-	default:
-		return -1;
-	}
+	while ((r = synchronise(-1)) != 1)
+		if (r < 0)
+			goto out;
+
+	r = 0;
+out:
+	saved_errno = errno;
+	event_remove(&timer);
+	close(timer.fd);
+	errno = saved_errno;
+	return r;
 }
 
 
@@ -402,6 +1961,115 @@ list_crtcs(void)
 }
 
 
+/**
+ * Send a CRTC information request
+ * 
+ * @param   ctx    The libcoopgamma context
+ * @param   index  The index of the CRTC
+ * @param   async  Output parameter for the asynchronous call context
+ * @return         Zero on success, -1 on error
+ */
+static int
+send_crtc_info(libcoopgamma_context_t *ctx, size_t index, libcoopgamma_async_context_t *async)
+{
+	return libcoopgamma_get_gamma_info_send(crtcs[index], ctx, async);
+}
+
+
+/**
+ * Receive CRTC information
+ * 
+ * @param   ctx    The libcoopgamma context
+ * @param   index  The index of the CRTC
+ * @param   async  The asynchronous call context
+ * @return         Zero on success, -2 on libcoopgamma error
+ */
+static int
+recv_crtc_info(libcoopgamma_context_t *ctx, size_t index, libcoopgamma_async_context_t *async)
+{
+	return libcoopgamma_get_gamma_info_recv(crtc_info + index, ctx, async) < 0 ? -2 : 0;
+}
+
+
+/**
+ * CRTC information requests
+ */
+static const pipeline_kind_t crtc_info_request = {&send_crtc_info, &recv_crtc_info};
+
+
+/**
+ * Calculate the hash of a list of CRTC:s
+ * 
+ * @param   list  The names of the CRTC:s
+ * @param   n     The number of elements in `list`
+ * @return        The hash of the list, never 0
+ */
+static uint64_t
+hash_crtc_list(char *const *list, size_t n)
+{
+	uint64_t hash = CACHE_HASH_INIT;
+	size_t i;
+	for (i = 0; i < n; i++)
+		hash = cache_hash(list[i], strlen(list[i]) + 1, hash);
+	return hash | 1;
+}
+
+
+/**
+ * Request the list of all CRTC:s
+ * 
+ * @param   ctx    The libcoopgamma context
+ * @param   index  Not used
+ * @param   async  Output parameter for the asynchronous call context
+ * @return         Zero on success, -1 on error
+ */
+static int
+send_crtc_list(libcoopgamma_context_t *ctx, size_t index, libcoopgamma_async_context_t *async)
+{
+	return libcoopgamma_get_crtcs_send(ctx, async);
+	(void) index;
+}
+
+
+/**
+ * Receive the list of all CRTC:s, and mark the CRTC
+ * information cache as stale if `crtc_info` was loaded
+ * from it and the list has changed since it was stored
+ * 
+ * @param   ctx    The libcoopgamma context
+ * @param   index  Not used
+ * @param   async  The asynchronous call context
+ * @return         Zero on success, -2 on libcoopgamma error
+ */
+static int
+recv_crtc_list(libcoopgamma_context_t *ctx, size_t index, libcoopgamma_async_context_t *async)
+{
+	char **list;
+	size_t n;
+	uint64_t hash;
+
+	list = libcoopgamma_get_crtcs_recv(ctx, async);
+	if (!list)
+		return -2;
+	for (n = 0; list[n]; n++);
+	hash = hash_crtc_list(list, n);
+	free(list);
+
+	if (crtc_info_cached && hash != crtc_cache_key.crtcs_hash)
+		crtc_cache_stale = 1;
+	crtc_cache_key.crtcs_hash = hash;
+	return 0;
+	(void) index;
+}
+
+
+/**
+ * CRTC list requests, used to validate the
+ * CRTC information cache when -c is used
+ */
+static const pipeline_kind_t crtc_list_request = {&send_crtc_list, &recv_crtc_list};
+
+
 /**
  * Fill the list of CRTC information
  * 
@@ -411,94 +2079,371 @@ list_crtcs(void)
 static int
 get_crtc_info(void)
 {
-	size_t i, unsynced = 0, selected;
-	char *synced;
-	int need_flush = 0;
-	struct pollfd pollfd;
+	size_t i;
+	int r;
+
+	for (i = 0; i < crtcs_n; i++)
+		if (pipeline_submit(&pipeline, &crtc_info_request, i) < 0)
+			return -1;
+	if (verify_crtc_list && crtc_cache_path)
+		if (pipeline_submit(&pipeline, &crtc_list_request, 0) < 0)
+			return -1;
+
+	while ((r = synchronise(-1)) != 1)
+		if (r < 0)
+			return r;
+
+	return 0;
+}
+
+
+/**
+ * Remove the filters, `crtc_updates` shall be
+ * prepared with `LIBCOOPGAMMA_REMOVE` as lifespan
+ * 
+ * @return  Zero on success, -1 on error, -2
+ *          on libcoopgamma error
+ */
+static int
+remove_filters(void)
+{
+	size_t i;
+	int r;
+
+	for (i = 0; i < filters_n; i++)
+		if (update_filter(i) < 0)
+			return -1;
 
-	synced = alloca(crtcs_n * sizeof(*synced));
-	memset(synced, 0, crtcs_n * sizeof(*synced));
+	while ((r = synchronise(-1)) != 1)
+		if (r < 0)
+			return r;
 
-	i = 0;
-	pollfd.fd = cg.fd;
-	pollfd.events = POLLIN | POLLRDNORM | POLLRDBAND | POLLPRI;
+	report_failures();
+	return 0;
+}
 
-	while (unsynced > 0 || i < crtcs_n) {
-	wait:
-		if (i < crtcs_n)
-			pollfd.events |= POLLOUT;
-		else
-			pollfd.events &= ~POLLOUT;
-      
-		pollfd.revents = 0;
-		if (poll(&pollfd, (nfds_t)1, -1) < 0)
-			goto fail;
-      
-		if (pollfd.revents & (POLLOUT | POLLERR | POLLHUP | POLLNVAL)) {
-			if (need_flush && (libcoopgamma_flush(&cg) < 0))
-				goto send_fail;
-			need_flush = 0;
-			for (; i < crtcs_n; i++)
-				if (unsynced++, libcoopgamma_get_gamma_info_send(crtcs[i], &cg, asyncs + i) < 0)
-					goto send_fail;
-			goto send_done;
-		send_fail:
-			switch (errno) {
-			case EINTR:
-			case EAGAIN:
-#if EAGAIN != EWOULDBLOCK
-			case EWOULDBLOCK:
-#endif
-				i++;
-				need_flush = 1;
+
+/**
+ * Select the CRTC information cache for the server
+ * 
+ * Caching is disabled if it cannot be selected
+ * 
+ * If not all CRTC:s are selected, the list of all
+ * CRTC:s is not known, and is instead requested
+ * along with the first requests to the server
+ * 
+ * @param  method  The adjustment method, `NULL` for the default
+ * @param  site    The site, `NULL` for the default
+ * @param  all     Whether all CRTC:s are selected
+ */
+static void
+select_crtc_cache(const char *method, const char *site, int all)
+{
+	char *socket_file, *pid_file, name[sizeof("crtc-info-") + 16];
+	struct stat st;
+	uint64_t hash;
+
+	socket_file = libcoopgamma_get_socket_file(method, site);
+	pid_file = libcoopgamma_get_pid_file(method, site);
+	if (!socket_file || !pid_file || stat(pid_file, &st) < 0)
+		goto out;
+
+	crtc_cache_key.magic       = CRTC_CACHE_MAGIC;
+	crtc_cache_key.info_size   = sizeof(libcoopgamma_crtc_info_t);
+	crtc_cache_key.server_dev  = (uint64_t)st.st_dev;
+	crtc_cache_key.server_ino  = (uint64_t)st.st_ino;
+	crtc_cache_key.server_sec  = (int64_t)st.st_mtim.tv_sec;
+	crtc_cache_key.server_nsec = (int64_t)st.st_mtim.tv_nsec;
+	if (all)
+		crtc_cache_key.crtcs_hash = hash_crtc_list(crtcs, crtcs_n);
+	else
+		verify_crtc_list = 1;
+
+	hash = cache_hash(socket_file, strlen(socket_file), CACHE_HASH_INIT);
+	sprintf(name, "crtc-info-%016" PRIx64, hash);
+	crtc_cache_path = cache_pathname("XDG_RUNTIME_DIR", NULL, name);
+
+out:
+	free(socket_file);
+	free(pid_file);
+}
+
+
+/**
+ * Select the directory of the ramp cache, and
+ * identify the program's executable, so that
+ * gamma ramps calculated by another build of
+ * the program are not used
+ * 
+ * Caching is disabled if it cannot be selected
+ */
+static void
+select_ramp_cache(void)
+{
+	struct stat st;
+
+	if (stat("/proc/self/exe", &st) < 0)
+		goto fail;
+
+	ramp_cache_key.magic    = RAMP_CACHE_MAGIC;
+	ramp_cache_key.exe_dev  = (uint64_t)st.st_dev;
+	ramp_cache_key.exe_ino  = (uint64_t)st.st_ino;
+	ramp_cache_key.exe_size = (uint64_t)st.st_size;
+	ramp_cache_key.exe_sec  = (int64_t)st.st_mtim.tv_sec;
+	ramp_cache_key.exe_nsec = (int64_t)st.st_mtim.tv_nsec;
+
+	ramp_cache_dir = cache_pathname("XDG_CACHE_HOME", ".cache", "");
+	if (ramp_cache_dir)
+		return;
+fail:
+	ramp_cache = 0;
+}
+
+
+/**
+ * Fill the list of CRTC information from the cache
+ * 
+ * If -c is used, the list of all CRTC:s is requested,
+ * and checked against the cache, along with the first
+ * filter updates, see `verify_crtc_info`
+ * 
+ * @return  1 if the cache was used, 0 if it
+ *          is missing or out of date
+ */
+static int
+load_crtc_info_cache(void)
+{
+	const struct crtc_cache_header *header;
+	const struct crtc_cache_entry *entries;
+	const char *data;
+	size_t size, i, j, n;
+
+	if (!crtc_cache_path)
+		return 0;
+	data = cache_map(crtc_cache_path, &size);
+	if (!data)
+		return 0;
+
+	header = (const void *)data;
+	entries = (const void *)&header[1];
+	if (size < sizeof(*header) ||
+	    header->magic       != crtc_cache_key.magic ||
+	    header->info_size   != crtc_cache_key.info_size ||
+	    header->server_dev  != crtc_cache_key.server_dev ||
+	    header->server_ino  != crtc_cache_key.server_ino ||
+	    header->server_sec  != crtc_cache_key.server_sec ||
+	    header->server_nsec != crtc_cache_key.server_nsec ||
+	    (verify_crtc_list ? !header->crtcs_hash : header->crtcs_hash != crtc_cache_key.crtcs_hash) ||
+	    header->count > (size - sizeof(*header)) / sizeof(*entries))
+		goto miss;
+
+	for (i = 0; i < crtcs_n; i++) {
+		n = strlen(crtcs[i]);
+		for (j = 0; j < header->count; j++)
+			if (entries[j].name_length == n && entries[j].name_offset <= size - n &&
+			    !memcmp(data + entries[j].name_offset, crtcs[i], n))
 				break;
-			default:
-				goto fail;
-			}
-		}
-	send_done:
+		if (j == header->count)
+			goto miss;
+		crtc_info[i] = entries[j].info;
+	}
+
+	if (verify_crtc_list) {
+		if (pipeline_submit(&pipeline, &crtc_list_request, 0) < 0)
+			goto miss;
+		crtc_cache_key.crtcs_hash = header->crtcs_hash;
+	}
+
+	cache_unmap((void *)data, size);
+	crtc_info_cached = 1;
+	return 1;
+miss:
+	cache_unmap((void *)data, size);
+	return 0;
+}
 
-		if (!unsynced && i == crtcs_n)
+
+/**
+ * Store the list of CRTC information in the cache,
+ * failure is ignored
+ */
+static void
+save_crtc_info_cache(void)
+{
+	struct crtc_cache_header *header;
+	struct crtc_cache_entry *entries;
+	char *data, *names;
+	size_t size, i, n;
+
+	if (!crtc_cache_path || !crtc_cache_key.crtcs_hash)
+		return;
+
+	size = sizeof(*header) + crtcs_n * sizeof(*entries);
+	for (i = 0; i < crtcs_n; i++)
+		size += strlen(crtcs[i]);
+	data = calloc(1, size);
+	if (!data)
+		return;
+
+	header = (void *)data;
+	entries = (void *)&header[1];
+	names = (char *)&entries[crtcs_n];
+	*header = crtc_cache_key;
+	header->count = crtcs_n;
+	for (i = 0; i < crtcs_n; i++) {
+		n = strlen(crtcs[i]);
+		entries[i].info = crtc_info[i];
+		entries[i].name_offset = (uint64_t)(names - data);
+		entries[i].name_length = n;
+		memcpy(names, crtcs[i], n);
+		names += n;
+	}
+
+	cache_write(crtc_cache_path, data, size);
+	free(data);
+}
+
+
+/**
+ * Wait for the filter updates submitted by the first
+ * fill since `crtc_info` was loaded from the cache, and
+ * if the cache turned out to be out of date, query the
+ * server for the CRTC information, store it in the cache,
+ * and refill and resubmit the filters whose gamma ramp
+ * type or sizes have changed, or whose CRTC:s have become
+ * supported; other failed updates are left to be reported
+ * 
+ * Filters that have changed stop sharing gamma ramps with
+ * other filters, the slaves of changed masters are
+ * refilled and resubmitted on their own
+ * 
+ * @param   job     The job the filters were filled in, its
+ *                  `.indices` is reused for the refill
+ * @param   submit  `update_filter` or `refresh_filter`
+ * @return          0: Success
+ *                  -1: Error, `errno` set
+ *                  -2: Error, `cg.error` set
+ */
+static int
+verify_crtc_info(struct fill_job *job, int (*submit)(size_t))
+{
+	libcoopgamma_support_t *supported;
+	libcoopgamma_crtc_info_t *info;
+	filter_update_t *update;
+	char *changed;
+	size_t i, j, k, index;
+	int r;
+
+	while ((r = synchronise(-1)) != 1)
+		if (r < 0)
+			return r;
+
+	crtc_info_cached = 0;
+	if (!crtc_cache_stale)
+		return 0;
+	crtc_cache_stale = 0;
+	unlink(crtc_cache_path);
+
+	supported = alloca(crtcs_n * sizeof(*supported));
+	for (i = 0; i < crtcs_n; i++)
+		supported[i] = crtc_info[i].supported;
+	if ((r = get_crtc_info()) < 0)
+		return r;
+	save_crtc_info_cache();
+
+	changed = alloca(filters_n);
+	for (i = 0; i < filters_n; i++) {
+		update = &crtc_updates[i];
+		info = &crtc_info[update->crtc];
+		changed[i] = info->supported &&
+		             (!supported[update->crtc] ||
+		              update->filter.depth != info->depth ||
+		              update->filter.ramps.u8.red_size   != info->red_size ||
+		              update->filter.ramps.u8.green_size != info->green_size ||
+		              update->filter.ramps.u8.blue_size  != info->blue_size);
+		switch (info->depth) {
+#define X(CONST, MEMBER, MAX, TYPE)\
+		case CONST:
+		LIST_DEPTHS
+#undef X
 			break;
-      
-		if (pollfd.revents & (POLLIN | POLLRDNORM | POLLRDBAND | POLLPRI)) {
-			while (unsynced > 0) {
-				switch (libcoopgamma_synchronise(&cg, asyncs, i, &selected)) {
-				case 0:
-					if (synced[selected]) {
-						libcoopgamma_skip_message(&cg);
-						break;
-					}
-					synced[selected] = 1;
-					unsynced -= 1;
-					if (libcoopgamma_get_gamma_info_recv(crtc_info + selected, &cg, asyncs + selected) < 0)
-						goto cg_fail;
-					break;
-				case -1:
-					switch (errno)
-						{
-						case 0:
-							break;
-						case EINTR:
-						case EAGAIN:
-#if EAGAIN != EWOULDBLOCK
-						case EWOULDBLOCK:
-#endif
-							goto wait;
-						default:
-							goto fail;
-						}
-					break;
+		default:
+			changed[i] = 0;
+			break;
+		}
+	}
+
+	for (i = 0; i < filters_n; i++) {
+		update = &crtc_updates[i];
+		if (update->slaves) {
+			for (j = k = 0; update->slaves[j]; j++) {
+				index = update->slaves[j];
+				if (!changed[i] && !changed[index]) {
+					update->slaves[k++] = index;
+					continue;
 				}
+				crtc_updates[index].master = 1;
+				crtc_updates[index].filter.ramps.u8.red   = NULL;
+				crtc_updates[index].filter.ramps.u8.green = NULL;
+				crtc_updates[index].filter.ramps.u8.blue  = NULL;
+				changed[index] = 1;
 			}
+			update->slaves[k] = 0;
 		}
+		for (j = k = 0; j < update->peers_n; j++) {
+			index = update->peers[j];
+			if (changed[i] || changed[index])
+				crtc_updates[index].peer = 0;
+			else
+				update->peers[k++] = index;
+		}
+		update->peers_n = k;
+	}
+
+	job->n = 0;
+	for (i = 0; i < filters_n; i++) {
+		if (!changed[i])
+			continue;
+		update = &crtc_updates[i];
+		info = &crtc_info[update->crtc];
+		if (update->filter.ramps.u8.red)
+			libcoopgamma_ramps_destroy(&update->filter.ramps.u8);
+		update->filter.ramps.u8.red   = NULL;
+		update->filter.ramps.u8.green = NULL;
+		update->filter.ramps.u8.blue  = NULL;
+		update->filter.depth               = info->depth;
+		update->filter.ramps.u8.red_size   = info->red_size;
+		update->filter.ramps.u8.green_size = info->green_size;
+		update->filter.ramps.u8.blue_size  = info->blue_size;
+		update->hashed = 0;
+		if (update->failed) {
+			libcoopgamma_error_destroy(&update->error);
+			libcoopgamma_error_initialise(&update->error);
+			update->failed = 0;
+		}
+		job->indices[job->n++] = i;
+	}
+	if (!job->n)
+		return 0;
+
+	/* The scratch ramps are sized for the largest CRTC */
+	if (scratch) {
+		free(scratch_stops);
+		free(scratch);
+		scratch_stops = NULL;
+		scratch = NULL;
+		scratch_stride = 0;
+		if (reserve_scratch() < 0)
+			return -1;
 	}
 
+	if (run_fill_job(job) < 0)
+		return -1;
+	for (i = 0; i < job->n; i++)
+		if (!job->results[i] && submit(job->indices[i]) < 0)
+			return -1;
+
 	return 0;
-fail:
-	return -1;
-cg_fail:
-	return -2;
 }
 
 
@@ -530,6 +2475,14 @@ cg_fail:
  *     if RULE is "??" the default class is printed
  *     to stdout.
  * 
+ * -v
+ *     Print the number of filter updates that were
+ *     sent, the number that were not sent because the
+ *     gamma ramps were unchanged, the number of
+ *     scratch ramp allocations, and the number of
+ *     filters that were and were not found in the
+ *     ramp cache, to stderr on exit.
+ * 
  * @param   argc  The number of command line arguments
  * @param   argv  The command line arguments
  * @return        0 on success, 1 on error
@@ -546,13 +2499,14 @@ main(int argc, char *argv[])
 	int64_t priority = default_priority;
 	char *prio = NULL;
 	char *rule = NULL;
+	char *fifo = NULL;
 	char *class = default_class;
 	char **classes = NULL;
 	size_t classes_n = 0;
 	int explicit_crtcs = 0;
 	int have_crtc_q = 0;
 	size_t i, filter_i;
-	const char *side, *crtc;
+	const char *side;
 	size_t len, n;
 	char *args, *arg, *end, *p, opt[3];
 	int at_end;
@@ -600,6 +2554,14 @@ main(int argc, char *argv[])
 			} else if (!strcmp(opt, "-R")) {
 				if (rule || !(rule = arg))
 					usage();
+			} else if (!strcmp(opt, "-D")) {
+				if (fifo || !(fifo = arg))
+					usage();
+			} else if (!strcmp(opt, "-v")) {
+				if (print_stats)
+					usage();
+				print_stats = 1;
+				goto next_opt;
 			} else {
 				switch (handle_opt(opt, arg)) {
 				case 0:
@@ -619,6 +2581,10 @@ main(int argc, char *argv[])
 
 	crtcs_n = crtc_i;
 	crtcs[crtc_i] = NULL;
+	if (fifo && !handle_update) {
+		fprintf(stderr, "%s: resident mode is not supported\n", argv0);
+		goto custom_fail;
+	}
 	if (!have_crtc_q && nulstrcmp(method, "?") &&
 	    nulstrcmp(rule, "?") && nulstrcmp(rule, "??") &&
 	    (default_priority == NO_DEFAULT_PRIORITY || nulstrcmp(prio, "?")))
@@ -665,6 +2631,14 @@ main(int argc, char *argv[])
 		return 0;
 	}
 
+	if (fifo && !have_crtc_q) {
+		if (mkfifo(fifo, S_IRUSR | S_IWUSR) < 0 && errno != EEXIST)
+			goto fail;
+		resident_fd = open(fifo, O_RDWR | O_NONBLOCK);
+		if (resident_fd < 0)
+			goto fail;
+	}
+
 	if (libcoopgamma_context_initialise(&cg) < 0)
 		goto fail;
 	stage++;
@@ -722,19 +2696,55 @@ main(int argc, char *argv[])
 	if (libcoopgamma_set_nonblocking(&cg, 1) < 0)
 		goto fail;
 
-	asyncs = alloca(filters_n * sizeof(*asyncs));
-	memset(asyncs, 0, filters_n * sizeof(*asyncs));
-	for (filter_i = 0; filter_i < filters_n; filter_i++)
-		if (libcoopgamma_async_context_initialise(asyncs + filter_i) < 0)
+	if (pipeline_initialise(&pipeline, &cg, PIPELINE_WINDOW) < 0)
+		goto fail;
+	if (event_initialise() < 0)
+		goto fail;
+	server_source.fd = cg.fd;
+	server_source.events = EPOLLIN;
+	server_source.handler = &server_ready;
+	if (event_add(&server_source) < 0)
+		goto fail;
+
+	if (remove_mode) {
+		crtc_updates = alloca(filters_n * sizeof(*crtc_updates));
+		memset(crtc_updates, 0, filters_n * sizeof(*crtc_updates));
+		for (filter_i = i = 0; i < classes_n; i++) {
+			for (crtc_i = 0; crtc_i < crtcs_n; crtc_i++, filter_i++) {
+				if (libcoopgamma_filter_initialise(&crtc_updates[filter_i].filter) < 0)
+					goto fail;
+				if (libcoopgamma_error_initialise(&crtc_updates[filter_i].error) < 0)
+					goto fail;
+				crtc_updates[filter_i].crtc = crtc_i;
+				crtc_updates[filter_i].synced = 1;
+				crtc_updates[filter_i].filter.crtc     = crtcs[crtc_i];
+				crtc_updates[filter_i].filter.class    = classes[i];
+				crtc_updates[filter_i].filter.lifespan = LIBCOOPGAMMA_REMOVE;
+			}
+		}
+		switch (remove_filters()) {
+		case 0:
+			goto done;
+		case -1:
 			goto fail;
+		default:
+			goto cg_fail;
+		}
+	}
 
-	switch (get_crtc_info()) {
-	case 0:
-		break;
-	case -1:
-		goto fail;
-	case -2:
-		goto cg_fail;
+	select_crtc_cache(method, site, !explicit_crtcs);
+	if (ramp_cache)
+		select_ramp_cache();
+	if (!load_crtc_info_cache()) {
+		switch (get_crtc_info()) {
+		case 0:
+			break;
+		case -1:
+			goto fail;
+		case -2:
+			goto cg_fail;
+		}
+		save_crtc_info_cache();
 	}
 
 	for (crtc_i = 0; crtc_i < crtcs_n; crtc_i++) {
@@ -771,8 +2781,6 @@ main(int argc, char *argv[])
 			switch (crtc_updates[filter_i].filter.depth) {
 #define X(CONST, MEMBER, MAX, TYPE)\
 			case CONST:\
-				libcoopgamma_ramps_initialise(&crtc_updates[filter_i].filter.ramps.MEMBER);\
-				libclut_start_over(&crtc_updates[filter_i].filter.ramps.MEMBER, MAX, TYPE, 1, 1, 1);\
 				break;
 			LIST_DEPTHS
 #undef X
@@ -795,40 +2803,36 @@ main(int argc, char *argv[])
 		goto custom_fail;
 	}
 
-	for (filter_i = 0; filter_i < filters_n; filter_i++) {
-		if (crtc_updates[filter_i].failed) {
-			side = cg.error.server_side ? "server" : "client";
-			crtc = crtc_updates[filter_i].filter.crtc;
-			if (cg.error.custom) {
-				if (cg.error.number && cg.error.description) {
-					fprintf(stderr, "%s: %s-side error number %" PRIu64 " for CRTC %s: %s\n",
-						argv0, side, cg.error.number, crtc, cg.error.description);
-				} else if (cg.error.number) {
-					fprintf(stderr, "%s: %s-side error number %" PRIu64 " for CRTC %s\n",
-						argv0, side, cg.error.number, crtc);
-				} else if (cg.error.description) {
-					fprintf(stderr, "%s: %s-side error for CRTC %s: %s\n",
-						argv0, side, crtc, cg.error.description);
-				}
-			} else if (cg.error.description) {
-				fprintf(stderr, "%s: %s-side error for CRTC %s: %s\n",
-				        argv0, side, crtc, cg.error.description);
-			} else {
-				fprintf(stderr, "%s: %s-side error for CRTC %s: %s\n",
-				        argv0, side, crtc, strerror((int)cg.error.number));
-			}
+	report_failures();
+
+	if (resident_fd >= 0) {
+		switch (serve_updates()) {
+		case -1:
+			goto fail;
+		default:
+			goto cg_fail;
 		}
 	}
 
 done:
+	if (print_stats)
+		fprintf(stderr, "%s: %zu filter updates sent, %zu unchanged updates not sent, "
+		        "%zu scratch allocations, %zu ramp cache hits, %zu ramp cache misses\n",
+		        argv0, updates_sent, updates_elided, scratch_allocations,
+		        ramp_cache_hits, ramp_cache_misses);
+	if (resident_fd >= 0)
+		close(resident_fd);
 	if (dealloc_crtcs)
 		free(crtcs);
 	if (crtc_info)
 		for (crtc_i = 0; crtc_i < crtcs_n; crtc_i++)
 			libcoopgamma_crtc_info_destroy(crtc_info + crtc_i);
-	if (asyncs)
-		for (filter_i = 0; filter_i < filters_n; filter_i++)
-			libcoopgamma_async_context_destroy(asyncs + filter_i);
+	pipeline_destroy(&pipeline);
+	event_destroy();
+	free(crtc_cache_path);
+	free(ramp_cache_dir);
+	free(scratch_stops);
+	free(scratch);
 	if (stage >= 1)
 		libcoopgamma_context_destroy(&cg, stage >= 2);
 	if (crtc_updates) {
@@ -842,6 +2846,7 @@ done:
 			libcoopgamma_filter_destroy(&crtc_updates[filter_i].filter);
 			libcoopgamma_error_destroy(&crtc_updates[filter_i].error);
 			free(crtc_updates[filter_i].slaves);
+			free(crtc_updates[filter_i].peers);
 		}
 	}
 	return rc;
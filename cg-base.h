@@ -11,6 +11,51 @@
  */
 #define NO_DEFAULT_PRIORITY INT64_MAX
 
+/**
+ * The default value of `frame_rate`
+ */
+#define DEFAULT_FRAME_RATE 60
+
+/**
+ * `fill_filters` flag: submit the filled
+ * filters with `update_filter`
+ */
+#define FILL_UPDATE 1
+
+/**
+ * `fill_filters` flag: submit the filled
+ * filters with `refresh_filter`
+ */
+#define FILL_REFRESH 2
+
+/**
+ * `fill_filters` flag: the fill function applies
+ * the same transformation to all channels, so
+ * for filters whose channels are of the same
+ * size, only the red channel need to be filled
+ */
+#define FILL_SAME_CHANNELS 4
+
+/**
+ * `fill_filters` flag: the fill function transforms
+ * the current gamma ramps, so they shall be reset
+ * to identity ramps before the filter is filled
+ */
+#define FILL_IDENTITY 8
+
+
+
+/**
+ * Marks a function that shall be vectorised and compiled
+ * both for the baseline instruction set and for AVX2,
+ * with the version to use selected at runtime
+ */
+#if defined(__GNUC__) && !defined(__clang__) && defined(__x86_64__) && defined(__GLIBC__)
+# define MULTIVERSION __attribute__((__target_clones__("avx2", "default"), __optimize__("tree-vectorize", "vect-cost-model=dynamic")))
+#else
+# define MULTIVERSION
+#endif
+
 
 
 /**
@@ -45,9 +90,11 @@ typedef struct filter_update
 	 * `.filter.crtc`, `.filter.class`, and
 	 * `.filter.priority` (unless `default_priority`
 	 * is `NO_DEFAULT_PRIORITY`), `.filter.depth`
-	 * are preconfigured, and `.filter.ramps`
-	 * is preinitialised and preset to an
-	 * identity ramp
+	 * are preconfigured, and so are the sizes in
+	 * `.filter.ramps`, but the gamma ramps are not
+	 * allocated until they are needed by `make_slaves`
+	 * or `fill_filters`, and they are only preset to
+	 * identity ramps if `FILL_IDENTITY` is used
 	 */
 	libcoopgamma_filter_t filter;
 
@@ -61,6 +108,25 @@ typedef struct filter_update
 	 */
 	int synced;
 
+	/**
+	 * Have the gamma ramps been changed since the
+	 * pending update was sent? If so, the update
+	 * is sent again once it has been synchronised
+	 */
+	int stale;
+
+	/**
+	 * Hash of the gamma ramps of the latest update
+	 * submitted with `refresh_filter`, only set if
+	 * `.hashed` is true
+	 */
+	uint64_t hash;
+
+	/**
+	 * Is `.hash` set?
+	 */
+	int hashed;
+
 	/**
 	 * Did the update fail?
 	 */
@@ -87,9 +153,46 @@ typedef struct filter_update
 	 */
 	size_t *slaves;
 
+	/**
+	 * Elements in `.crtc_updates` whose gamma ramps
+	 * are translated from this instance's gamma ramps,
+	 * computed in double precision, by `fill_filters`
+	 * 
+	 * This will only be set if `.master` is true
+	 */
+	size_t *peers;
+
+	/**
+	 * The number of elements in `.peers`
+	 */
+	size_t peers_n;
+
+	/**
+	 * Are the gamma ramps translated from the
+	 * gamma ramps of another element in
+	 * `.crtc_updates` rather than filled?
+	 */
+	int peer;
+
 } filter_update_t;
 
 
+/**
+ * Fill the gamma ramps of a filter
+ * 
+ * The function may be called from multiple threads at
+ * the same time, and must not modify anything but the
+ * gamma ramps of the filter
+ * 
+ * @param   index  The index of the filter in `crtc_updates`
+ * @param   data   The argument passed to `fill_filters`
+ * @return         0: Success
+ *                 1: Success, but the filter shall not be submitted
+ *                 -1: Error, `errno` set
+ */
+typedef int fill_func_t(size_t index, void *data);
+
+
 
 /**
  * The process's name
@@ -127,6 +230,33 @@ extern size_t crtcs_n;
  */
 extern size_t filters_n;
 
+/**
+ * -x: remove filter rather than adding it
+ * 
+ * If set by `handle_opt` or `handle_args`,
+ * the filters are removed without fetching
+ * CRTC information, allocating gamma ramps,
+ * or calling `start`
+ */
+extern int remove_mode;
+
+/**
+ * -C: cache filled gamma ramps on disk
+ * 
+ * If set by `handle_opt` or `handle_args`,
+ * `fill_cached_filters` looks the gamma ramps
+ * up in, and adds them to, a cache under
+ * $XDG_CACHE_HOME; it is cleared if the cache
+ * is unavailable
+ */
+extern int ramp_cache;
+
+/**
+ * The number of frames per second `animate` shall
+ * render, must be positive when `animate` is called
+ */
+extern double frame_rate;
+
 
 
 /**
@@ -144,6 +274,26 @@ extern char default_class[];
  */
 extern const char *const *class_suffixes;
 
+/**
+ * Apply new parameters received in resident mode (-D),
+ * `NULL` if the program does not support resident mode
+ * 
+ * The master filters of supported CRTC:s shall be
+ * refilled by this function, with `fill_filters`,
+ * which allocates the gamma ramps if necessary and,
+ * if `FILL_IDENTITY` is used, resets them to identity
+ * ramps before filling them; they are not reset before
+ * this function is called; the filters are sent once
+ * it returns
+ * 
+ * @param   argc  The number of received arguments
+ * @param   argv  `NULL` terminated list of received arguments
+ * @return        0: Success
+ *                1: Invalid arguments, nothing will be sent
+ *                -1: Error, `errno` set
+ */
+extern int (*const handle_update)(int argc, char *argv[]);
+
 
 
 /**
@@ -154,36 +304,233 @@ extern const char *const *class_suffixes;
 int make_slaves(void);
 
 /**
- * Update a filter and synchronise calls
+ * Make elements in `crtc_updates` slaves where appropriate,
+ * as `make_slaves` does, but only make filters slaves of
+ * filters in the same group; use this instead of `make_slaves`
+ * if filters for CRTC:s with the same gamma ramp type and sizes
+ * can have different gamma ramps
  * 
- * @param   index    The index of the CRTC
- * @param   timeout  The number of milliseconds a call to `poll` may block,
- *                   -1 if it may block forever
- * @return           1: Success, no pending synchronisations
- *                   0: Success, with still pending synchronisations
- *                   -1: Error, `errno` set
- *                   -2: Error, `cg.error` set
+ * @param   groups  The group of each element in `crtc_updates`,
+ *                  `NULL` if all elements are in the same group
+ * @return          Zero on success, -1 on error
+ */
+int make_grouped_slaves(const size_t *groups);
+
+/**
+ * Make master elements in `crtc_updates` that only
+ * differ in gamma ramp type (or also in gamma ramp
+ * size if `resample` is non-zero) share computation:
+ * `fill_filters` fills one of them in double precision
+ * and translates the result to the others
+ * 
+ * This shall be called after `make_slaves`, and only
+ * if the fill function's transformation is independent
+ * of the gamma ramp type, and, if `resample` is non-zero,
+ * of the gamma ramp size; the fill function must start
+ * from the identity ramp
+ * 
+ * @param   resample  Whether filters with different gamma ramp
+ *                    sizes shall share computation, the ramps
+ *                    are then resampled, by linear interpolation,
+ *                    from the largest ramps, so they are not exact
+ *                    and this shall only be used when approximate
+ *                    ramps have been asked for
+ * @return            Zero on success, -1 on error
+ */
+int make_peers(int resample);
+
+/**
+ * Submit a filter update, it is sent by `synchronise`
+ * 
+ * @param   index  The index of the CRTC
+ * @return         0: Success, the update is pending
+ *                 -1: Error, `errno` set
+ */
+int update_filter(size_t index);
+
+/**
+ * Submit a filter update unless one is already pending,
+ * in which case only the latest gamma ramps are sent
+ * 
+ * Nothing is submitted if the gamma ramps are identical
+ * to those of the previous call to this function for
+ * the filter, unless `update_filter` has been called
+ * in between
+ * 
+ * If the pending update has not been sent yet, it
+ * will carry the current gamma ramps, otherwise the
+ * filter is sent again once the server has responded,
+ * so that at most one update per filter is waiting for
+ * a response; filters whose update failed are skipped
+ * 
+ * @param   index  The index of the CRTC
+ * @return         0: Success
+ *                 -1: Error, `errno` set
+ */
+int refresh_filter(size_t index);
+
+/**
+ * Fill the master filters of all supported CRTC:s,
+ * and optionally submit them and their slaves
+ * 
+ * If the gamma ramps are large enough for it to be
+ * worthwhile, the filters are filled in parallel;
+ * they are submitted afterwards in the same order
+ * as in `crtc_updates`
+ * 
+ * With `FILL_SAME_CHANNELS`, filters whose channels
+ * are of the same size are passed to `fill` with
+ * the green and blue ramps' sizes set to zero, and
+ * the red ramp is then copied to the other channels
+ * 
+ * Filters that are peers (see `make_peers`) are not
+ * passed to `fill`, their gamma ramps are translated
+ * from the gamma ramps of the filter they are a peer
+ * of, and they are submitted right after it
+ * 
+ * If the CRTC information was loaded from the cache,
+ * the first call that submits the filters waits for
+ * them to be synchronised; if the cache was out of
+ * date, the CRTC information is queried, and the
+ * filters whose gamma ramp type or sizes have changed
+ * are filled again, by calling `fill` again, and
+ * submitted again before the function returns
+ * 
+ * @param   fill   Function that fills a filter
+ * @param   data   Argument passed to `fill`
+ * @param   flags  0, `FILL_UPDATE`, or `FILL_REFRESH`, optionally
+ *                 OR:ed with `FILL_SAME_CHANNELS` and `FILL_IDENTITY`
+ * @return         0: Success
+ *                 -1: Error, `errno` set
+ *                 -2: Error, `cg.error` set
+ */
+int fill_filters(fill_func_t *fill, void *data, int flags);
+
+/**
+ * Fill the master filters of all supported CRTC:s,
+ * and optionally submit them and their slaves, as
+ * `fill_filters` does, but if `ramp_cache` is set,
+ * the gamma ramps are first looked up in the cache,
+ * and filled gamma ramps are added to the cache
+ * 
+ * The key in the cache is the program's executable,
+ * the filter's class, depth, and ramp sizes, `flags`,
+ * and `params`; so the gamma ramps must be a function
+ * of `params` and the filter's class, depth, and
+ * ramp sizes only
  * 
- * @throws  EINTR   Call to `poll` was interrupted by a signal
- * @throws  EAGAIN  Call to `poll` timed out
+ * When files are added to the cache, the least
+ * recently used files are removed if the cache
+ * has grown too large
+ * 
+ * @param   fill         Function that fills a filter
+ * @param   data         Argument passed to `fill`
+ * @param   flags        0, `FILL_UPDATE`, or `FILL_REFRESH`, optionally
+ *                       OR:ed with `FILL_SAME_CHANNELS` and `FILL_IDENTITY`
+ * @param   params       The parameters the gamma ramps are calculated from,
+ *                       must not contain padding
+ * @param   params_size  The size of `params`
+ * @return               0: Success
+ *                       -1: Error, `errno` set
+ *                       -2: Error, `cg.error` set
  */
-int update_filter(size_t index, int timeout);
+int fill_cached_filters(fill_func_t *fill, void *data, int flags, const void *params, size_t params_size);
 
 /**
- * Synchronised calls
+ * Allocate the scratch gamma ramps used by `scratch_ramps`
+ * 
+ * The scratch ramps are allocated in one block, sized for
+ * the largest CRTC, the first time the function is called,
+ * later calls do nothing; this shall be called before
+ * `fill_filters` is called with a function that uses
+ * `scratch_ramps`
+ * 
+ * @return  Zero on success, -1 on error
+ */
+int reserve_scratch(void);
+
+/**
+ * Get the scratch double-precision gamma ramps of a
+ * filter, for intermediate results in a `fill_func_t`
+ * 
+ * The ramps have the same sizes as the filter's ramps,
+ * their content is undefined; the scratch ramps of
+ * different filters do not overlap
+ * 
+ * @param   index  The index of the filter in `crtc_updates`
+ * @return         The scratch ramps, valid until the
+ *                 next call with the same index
+ */
+libcoopgamma_rampsd_t *scratch_ramps(size_t index);
+
+/**
+ * Send pending updates and synchronise calls
+ * 
+ * Submitted updates are sent together, and without
+ * waiting for responses, up to a fixed number of
+ * updates waiting for response
  * 
- * @param   timeout  The number of milliseconds a call to `poll` may block,
- *                   -1 if it may block forever
+ * The wait is done with `epoll_wait`, via `event_wait`, so
+ * the handlers of all added event sources are called while
+ * waiting, not only the handler of the server connection;
+ * signals received through a signal source (`event_signals`)
+ * and expirations of a timer source (`event_timer`) are
+ * thus handled by their handlers, and do not interrupt
+ * the wait, only signals that are not blocked do
+ * 
+ * @param   timeout  The number of milliseconds the wait for events may
+ *                   block, -1 if it may block forever
  * @return           1: Success, no pending synchronisations
  *                   0: Success, with still pending synchronisations
  *                   -1: Error, `errno` set
  *                   -2: Error, `cg.error` set
  * 
- * @throws  EINTR   Call to `poll` was interrupted by a signal
- * @throws  EAGAIN  Call to `poll` timed out
+ * @throws  EINTR   Call to `epoll_wait` was interrupted by
+ *                  a signal that is not blocked
+ * @throws  EAGAIN  Call to `epoll_wait` timed out
  */
 int synchronise(int timeout);
 
+/**
+ * Keep the process alive until it is killed, or the
+ * connection to the server is lost, and apply received
+ * parameter updates if running in resident mode (-D)
+ * 
+ * This function never returns successfully
+ * 
+ * @return  -1: Error, `errno` set
+ *          -2: Error, `cg.error` set
+ */
+int stay_alive(void);
+
+/**
+ * Render frames at `frame_rate` frames per
+ * second until the last frame has been rendered
+ * 
+ * Frames are scheduled at absolute deadlines, if
+ * rendering a frame overruns its period, missed
+ * frames are dropped rather than rendered late
+ * 
+ * The animation does not wait for the server to
+ * respond before the next frame is rendered, hence
+ * `frame` shall submit updates with `refresh_filter`
+ * rather than `update_filter`; once the last frame
+ * has been rendered, all updates are synchronised
+ * 
+ * @param   frame    Function that submits the updates for a frame with
+ *                   `refresh_filter`; `elapsed` is the number of seconds
+ *                   since the first frame, and `data` is the argument
+ *                   passed to `animate`; it shall return 0 if more frames
+ *                   shall be rendered, 1 if this was the last frame,
+ *                   or a negative value on error, like `start`
+ * @param   data     Argument passed to `frame`
+ * @return           0: Success
+ *                   -1: Error, `errno` set
+ *                   -2: Error, `cg.error` set
+ *                   -3: Error, message already printed
+ */
+int animate(int (*frame)(double elapsed, void *data), void *data);
+
 
 /**
  * Print usage information and exit
@@ -199,7 +546,7 @@ extern void usage(void);
  * @param   opt  The option, it is a NUL-terminate two-character
  *               string starting with either '-' or '+', if the
  *               argument is not recognised, call `usage`. This
- *               string will not be "-M", "-S", "-c", "-p", or "-R".
+ *               string will not be "-M", "-S", "-c", "-p", "-R", "-D", or "-v".
  * @param   arg  The argument associated with `opt`,
  *               `NULL` there is no next argument, if this
  *               parameter is `NULL` but needed, call `usage`
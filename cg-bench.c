@@ -0,0 +1,117 @@
+/* See LICENSE file for copyright and license details. */
+#include "cg-base.h"
+#include "cg-kernel.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+
+
+/**
+ * The minimum number of seconds each case is timed for
+ */
+#define MIN_SECONDS 0.25
+
+/**
+ * The name of the process
+ */
+const char *argv0 = "cg-bench";
+
+/**
+ * The affine kernels of the programs that fill
+ * their ramps with `kernel_fill`, as fractions
+ * of the identity ramp that are mapped to the
+ * minimum and maximum, and whether the ramps
+ * are reversed
+ */
+static const struct {
+	const char *command;
+	double min[3];
+	double max[3];
+	int reverse[3];
+} cases[] = {
+	{"cg-limits 0.1:0.9",              {.1, .1,  .1}, {.9, .9,  .9}, {0, 0, 0}},
+	{"cg-limits 0:1 0.1:0.8 -0.1:1.2", { 0, .1, -.1}, { 1, .8, 1.2}, {0, 0, 0}},
+	{"cg-darkroom 1",                  { 0,  0,   0}, { 1,  0,   0}, {1, 0, 0}}
+};
+
+/**
+ * The 16-bit ramp sizes that are timed
+ */
+static const size_t sizes[] = {256, 1024, 4096};
+
+
+
+/**
+ * Get the current time
+ * 
+ * @return  The current time, in seconds
+ */
+static double
+now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1000000000.;
+}
+
+
+/**
+ * Time `kernel_fill` for the affine kernels of the
+ * programs, for common sizes of 16-bit ramps
+ * 
+ * Build with an empty `LIST_SPECIALISED_SIZES`
+ * (`make bench` builds cg-bench-generic) to time
+ * the fill without the size-specialised versions
+ * 
+ * @param   argc  Not used
+ * @param   argv  The command line, `*argv` is the program name
+ * @return        0 on success, 1 on error
+ */
+int
+main(int argc, char *argv[])
+{
+	struct kernel kernels[3];
+	libcoopgamma_filter_t filter;
+	size_t i, j, k, n, rounds;
+	double start, elapsed;
+
+	argv0 = argv[0];
+
+	filter.depth = LIBCOOPGAMMA_UINT16;
+	filter.ramps.u16.red = malloc(3 * sizes[2] * sizeof(*filter.ramps.u16.red));
+	if (!filter.ramps.u16.red) {
+		perror(argv0);
+		return 1;
+	}
+
+	for (i = 0; i < sizeof(cases) / sizeof(*cases); i++) {
+		for (k = 0; k < 3; k++) {
+			kernels[k].reverse = cases[i].reverse[k];
+			kernels[k].n = 0;
+			kernel_push(&kernels[k], KERNEL_AFFINE, cases[i].max[k] - cases[i].min[k], cases[i].min[k]);
+			kernel_push(&kernels[k], KERNEL_CLIP, 0, 0);
+		}
+		for (j = 0; j < sizeof(sizes) / sizeof(*sizes); j++) {
+			n = sizes[j];
+			filter.ramps.u16.red_size = filter.ramps.u16.green_size = filter.ramps.u16.blue_size = n;
+			filter.ramps.u16.green = &filter.ramps.u16.red[n];
+			filter.ramps.u16.blue = &filter.ramps.u16.green[n];
+			kernel_fill(&filter, kernels);
+			rounds = 0;
+			start = now();
+			do {
+				for (k = 0; k < 64; k++)
+					kernel_fill(&filter, kernels);
+				rounds += 64;
+			} while ((elapsed = now() - start) < MIN_SECONDS);
+			printf("%s: %-32s %4zu stops: %6.3f ns/stop\n",
+			       argv0, cases[i].command, n, elapsed * 1000000000. / (double)(rounds * 3 * n));
+		}
+	}
+
+	free(filter.ramps.u16.red);
+	return 0;
+	(void) argc;
+}
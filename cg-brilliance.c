@@ -26,6 +26,12 @@ char default_class[] = PKGNAME "::cg-brilliance::standard";
  */
 const char *const *class_suffixes = (const char *const[]){NULL};
 
+/**
+ * Handler for parameter updates in resident mode
+ */
+static int update_params(int argc, char *argv[]);
+int (*const handle_update)(int argc, char *argv[]) = &update_params;
+
 
 
 /**
@@ -33,11 +39,6 @@ const char *const *class_suffixes = (const char *const[]){NULL};
  */
 static int dflag = 0;
 
-/**
- * -x: remove filter rather than adding it
- */
-static int xflag = 0;
-
 /**
  * The brilliance of the red channel
  */
@@ -62,8 +63,8 @@ void
 usage(void)
 {
 	fprintf(stderr,
-	        "usage: %s [-M method] [-S site] [-c crtc]... [-R rule] "
-	        "(-x | [-p priority] [-d] (all | red green blue))\n",
+	        "usage: %s [-M method] [-S site] [-c crtc]... [-R rule] [-v] "
+	        "(-x | [-p priority] [-d] [-D fifo] (all | red green blue))\n",
 	        argv0);
 	exit(1);
 }
@@ -75,7 +76,7 @@ usage(void)
  * @param   opt  The option, it is a NUL-terminate two-character
  *               string starting with either '-' or '+', if the
  *               argument is not recognised, call `usage`. This
- *               string will not be "-M", "-S", "-c", "-p", or "-R".
+ *               string will not be "-M", "-S", "-c", "-p", "-R", "-D", or "-v".
  * @param   arg  The argument associated with `opt`,
  *               `NULL` there is no next argument, if this
  *               parameter is `NULL` but needed, call `usage`
@@ -89,14 +90,14 @@ handle_opt(char *opt, char *arg)
 	if (opt[0] == '-') {
 		switch (opt[1]) {
 		case 'd':
-			if (dflag || xflag)
+			if (dflag || remove_mode)
 				usage();
 			dflag = 1;
 			break;
 		case 'x':
-			if (xflag || dflag)
+			if (remove_mode || dflag)
 				usage();
-			xflag = 1;
+			remove_mode = 1;
 			break;
 		default:
 			usage();
@@ -145,8 +146,8 @@ handle_args(int argc, char *argv[], char *prio)
 	char *red = NULL;
 	char *green = NULL;
 	char *blue = NULL;
-	int q = xflag + dflag;
-	if (q > 1 || (xflag && (prio || argc)))
+	int q = remove_mode + dflag;
+	if (q > 1 || (remove_mode && (prio || argc)))
 		usage();
 	if (argc == 1) {
 		red = green = blue = argv[0];
@@ -154,65 +155,125 @@ handle_args(int argc, char *argv[], char *prio)
 		red   = argv[0];
 		green = argv[1];
 		blue  = argv[2];
-	} else if (argc || !xflag) {
+	} else if (argc || !remove_mode) {
 		usage();
 	}
 	if (argc) {
 		if (parse_double(&rvalue, red) < 0)
 			usage();
-		if (parse_double(&gvalue, blue) < 0)
+		if (parse_double(&gvalue, green) < 0)
 			usage();
-		if (parse_double(&bvalue, green) < 0)
+		if (parse_double(&bvalue, blue) < 0)
 			usage();
 	}
 	return 0;
 }
 
 
+/**
+ * Multiply each stop in a gamma ramp by a factor
+ * and clip the stops to the valid range, there is
+ * one function per stop type, named after the
+ * member in `union libcoopgamma_ramps` for the type
+ * 
+ * The loops are written so that the compiler can
+ * vectorise them, and when possible, they are also
+ * compiled for AVX2, the best version is selected
+ * when the program is loaded
+ * 
+ * @param  stops   The stops of the gamma ramp
+ * @param  n       The number of stops in the gamma ramp
+ * @param  factor  The factor, must be non-negative
+ */
+#define X(MEMBER, MAX, TYPE)\
+	MULTIVERSION static void\
+	scale_##MEMBER(TYPE *restrict stops, size_t n, double factor)\
+	{\
+		double val;\
+		size_t i;\
+		for (i = 0; i < n; i++) {\
+			val = (double)stops[i] * factor;\
+			stops[i] = val >= (double)(MAX) ? (MAX) : (TYPE)val;\
+		}\
+	}
+X(u8,  UINT8_MAX,  uint8_t)
+X(u16, UINT16_MAX, uint16_t)
+X(u32, UINT32_MAX, uint32_t)
+X(u64, UINT64_MAX, uint64_t)
+#undef X
+#define X(MEMBER, TYPE)\
+	MULTIVERSION static void\
+	scale_##MEMBER(TYPE *restrict stops, size_t n, double factor)\
+	{\
+		TYPE val;\
+		size_t i;\
+		for (i = 0; i < n; i++) {\
+			val = (TYPE)(stops[i] * factor);\
+			stops[i] = val < 0 ? 0 : val > 1 ? 1 : val;\
+		}\
+	}
+X(f, float)
+X(d, double)
+#undef X
+
+
 /**
  * Fill a filter
  * 
- * @param  filter  The filter to fill
+ * @param   index  The index of the filter in `crtc_updates`
+ * @param   data   Not used
+ * @return         Zero
  */
-static void
-fill_filter(libcoopgamma_filter_t *restrict filter)
+static int
+fill_filter(size_t index, void *data)
 {
-	size_t i;
+	libcoopgamma_filter_t *restrict filter = &crtc_updates[index].filter;
 	switch (filter->depth) {
-#define X(CONST, MAX, TYPE, MEMBER)\
+#define X(CONST, MEMBER, MAX, TYPE)\
 	case CONST:\
-		for (i = 0; i < filter->ramps.MEMBER.red_size; i++) {\
-			double val = (double)(filter->ramps.MEMBER.red[i]);\
-			val *= rvalue;\
-			filter->ramps.MEMBER.red[i] = val < 0 ? 0 : val > (double)(MAX) ? MAX : (TYPE)val;\
-		}\
-		for (i = 0; i < filter->ramps.MEMBER.green_size; i++) {\
-			double val = (double)(filter->ramps.MEMBER.green[i]);\
-			val *= gvalue;\
-			filter->ramps.MEMBER.green[i] = val < 0 ? 0 : val > (double)(MAX) ? MAX : (TYPE)val;\
-		}\
-		for (i = 0; i < filter->ramps.MEMBER.blue_size; i++) {\
-			double val = (double)(filter->ramps.MEMBER.blue[i]);\
-			val *= bvalue;\
-			filter->ramps.MEMBER.blue[i] = val < 0 ? 0 : val > (double)(MAX) ? MAX : (TYPE)val;\
-		}\
-		break
-	X(LIBCOOPGAMMA_UINT8,  UINT8_MAX,  uint8_t,  u8);
-	X(LIBCOOPGAMMA_UINT16, UINT16_MAX, uint16_t, u16);
-	X(LIBCOOPGAMMA_UINT32, UINT32_MAX, uint32_t, u32);
-	X(LIBCOOPGAMMA_UINT64, UINT64_MAX, uint64_t, u64);
-#undef X
-	case LIBCOOPGAMMA_FLOAT:
-		libclut_rgb_brightness(&filter->ramps.f, (float)1, float, rvalue, gvalue, bvalue);
-		libclut_clip(&filter->ramps.f, (float)1, float, 1, 1, 1);
-		break;
-	case LIBCOOPGAMMA_DOUBLE:
-		libclut_rgb_brightness(&filter->ramps.d, (double)1, double, rvalue, gvalue, bvalue);
-		libclut_clip(&filter->ramps.d, (double)1, double, 1, 1, 1);
+		scale_##MEMBER(filter->ramps.MEMBER.red,   filter->ramps.MEMBER.red_size,   rvalue);\
+		scale_##MEMBER(filter->ramps.MEMBER.green, filter->ramps.MEMBER.green_size, gvalue);\
+		scale_##MEMBER(filter->ramps.MEMBER.blue,  filter->ramps.MEMBER.blue_size,  bvalue);\
 		break;
+	LIST_DEPTHS
+#undef X
 	default:
 		abort();
 	}
+	return 0;
+	(void) data;
+}
+
+
+/**
+ * Apply new parameters received in resident mode
+ * 
+ * @param   argc  The number of received arguments
+ * @param   argv  `NULL` terminated list of received arguments
+ * @return        0: Success
+ *                1: Invalid arguments
+ *                -1: Error, `errno` set
+ */
+static int
+update_params(int argc, char *argv[])
+{
+	double r, g, b;
+	if (argc == 1) {
+		if (parse_double(&r, argv[0]) < 0)
+			return 1;
+		g = b = r;
+	} else if (argc == 3) {
+		if (parse_double(&r, argv[0]) < 0 ||
+		    parse_double(&g, argv[1]) < 0 ||
+		    parse_double(&b, argv[2]) < 0)
+			return 1;
+	} else {
+		return 1;
+	}
+	rvalue = r;
+	gvalue = g;
+	bvalue = b;
+	return fill_filters(&fill_filter, NULL, FILL_IDENTITY | (r == g && g == b ? FILL_SAME_CHANNELS : 0));
 }
 
 
@@ -227,62 +288,29 @@ fill_filter(libcoopgamma_filter_t *restrict filter)
 int
 start(void)
 {
-	int r;
-	size_t i, j;
+	int r, same;
+	size_t i;
 
-	if (xflag)
-		for (i = 0; i < filters_n; i++)
-			crtc_updates[i].filter.lifespan = LIBCOOPGAMMA_REMOVE;
-	else if (dflag)
+	if (dflag)
 		for (i = 0; i < filters_n; i++)
 			crtc_updates[i].filter.lifespan = LIBCOOPGAMMA_UNTIL_DEATH;
 	else
 		for (i = 0; i < filters_n; i++)
 			crtc_updates[i].filter.lifespan = LIBCOOPGAMMA_UNTIL_REMOVAL;
 
-	if (!xflag && (r = make_slaves()) < 0)
+	if ((r = make_slaves()) < 0)
 		return r;
 
-	for (i = 0, r = 1; i < filters_n; i++) {
-		if (!crtc_updates[i].master || !crtc_info[crtc_updates[i].crtc].supported)
-			continue;
-		if (!xflag)
-			fill_filter(&crtc_updates[i].filter);
-		r = update_filter(i, 0);
-		if (r == -2 || (r == -1 && errno != EAGAIN))
-			return r;
-		if (crtc_updates[i].slaves) {
-			for (j = 0; crtc_updates[i].slaves[j]; j++) {
-				r = update_filter(crtc_updates[i].slaves[j], 0);
-				if (r == -2 || (r == -1 && errno != EAGAIN))
-					return r;
-			}
-		}
-	}
+	same = rvalue == gvalue && gvalue == bvalue ? FILL_SAME_CHANNELS : 0;
+	if ((r = fill_filters(&fill_filter, NULL, FILL_UPDATE | FILL_IDENTITY | same)) < 0)
+		return r;
 
-	while (r != 1)
-		if ((r = synchronise(-1)) < 0)
+	while ((r = synchronise(-1)) != 1)
+		if (r < 0)
 			return r;
 
 	if (!dflag)
 		return 0;
 
-	if (libcoopgamma_set_nonblocking(&cg, 0) < 0)
-		return -1;
-	for (;;) {
-		if (libcoopgamma_synchronise(&cg, NULL, 0, &j) < 0) {
-			switch (errno) {
-			case 0:
-				break;
-			case ENOTRECOVERABLE:
-				goto enotrecoverable;
-			default:
-				return -1;
-			}
-		}
-	}
-
-enotrecoverable:
-	pause();
-	return -1;
+	return stay_alive();
 }
@@ -0,0 +1,343 @@
+/* See LICENSE file for copyright and license details. */
+#include "cg-cache.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+
+
+/**
+ * The number of seconds after which a temporary file
+ * left by `cache_write` is assumed to be abandoned,
+ * because the process that wrote it died
+ */
+#ifndef CACHE_TEMP_MAX_AGE
+# define CACHE_TEMP_MAX_AGE 300
+#endif
+
+
+
+/**
+ * A file in a cache directory
+ */
+struct cache_file
+{
+	/**
+	 * The name of the file
+	 */
+	char *name;
+
+	/**
+	 * The size of the file
+	 */
+	uintmax_t size;
+
+	/**
+	 * The modification time of the file, in seconds
+	 */
+	time_t sec;
+
+	/**
+	 * The nanoseconds of the modification time of the file
+	 */
+	long nsec;
+};
+
+
+
+/**
+ * Compare two instances of `struct cache_file`
+ * by their modification times
+ * 
+ * @param   a_  Return -1 if this one was modified earlier
+ * @param   b_  Return +1 if this one was modified earlier
+ * @return      See `a_` and `b_`, 0 if the times are equal
+ */
+static int
+cache_file_cmp(const void *a_, const void *b_)
+{
+	const struct cache_file *a = a_;
+	const struct cache_file *b = b_;
+	if (a->sec != b->sec)
+		return a->sec < b->sec ? -1 : +1;
+	return a->nsec < b->nsec ? -1 : a->nsec > b->nsec;
+}
+
+
+/**
+ * Get the pathname of a file in the program's
+ * cache directory, and create the directory
+ * 
+ * @param   env       The environment variable that names the base directory
+ * @param   fallback  Base directory, relative to $HOME, to use if `env`
+ *                    is unset or empty, `NULL` if there is none
+ * @param   name      The name of the file
+ * @return            The pathname of the file, `NULL` on error; `errno`
+ *                    is set to 0 if no base directory is available
+ */
+char *
+cache_pathname(const char *env, const char *fallback, const char *name)
+{
+	const char *base = getenv(env), *home;
+	char *path, *p;
+	size_t len;
+
+	if (base && *base) {
+		fallback = "";
+	} else if (fallback && (home = getenv("HOME")) && *home) {
+		base = home;
+	} else {
+		errno = 0;
+		return NULL;
+	}
+
+	len = strlen(base) + strlen(fallback) + sizeof("//" PKGNAME "/") + strlen(name);
+	path = malloc(len);
+	if (!path)
+		return NULL;
+	p = stpcpy(stpcpy(path, base), *fallback ? "/" : "");
+	p = stpcpy(stpcpy(p, fallback), "/" PKGNAME);
+
+	for (p = strchr(path + 1, '/'); p; p = strchr(p + 1, '/')) {
+		*p = '\0';
+		if (mkdir(path, S_IRWXU) < 0 && errno != EEXIST)
+			goto fail;
+		*p = '/';
+	}
+	if (mkdir(path, S_IRWXU) < 0 && errno != EEXIST)
+		goto fail;
+
+	strcat(strcat(path, "/"), name);
+	return path;
+fail:
+	free(path);
+	return NULL;
+}
+
+
+/**
+ * Map a cache file into memory
+ * 
+ * @param   path   The pathname of the file
+ * @param   sizep  Output parameter for the size of the file
+ * @return         The file's content, `NULL` if the file does
+ *                 not exist, is empty, or cannot be read
+ */
+void *
+cache_map(const char *path, size_t *sizep)
+{
+	struct stat st;
+	void *data;
+	int fd;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &st) < 0 || st.st_size <= 0 || (uintmax_t)st.st_size > SIZE_MAX) {
+		close(fd);
+		return NULL;
+	}
+	*sizep = (size_t)st.st_size;
+	data = mmap(NULL, *sizep, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	return data == MAP_FAILED ? NULL : data;
+}
+
+
+/**
+ * Unmap a cache file mapped with `cache_map`
+ * 
+ * @param  data  The file's content
+ * @param  size  The size of the file
+ */
+void
+cache_unmap(void *data, size_t size)
+{
+	if (data)
+		munmap(data, size);
+}
+
+
+/**
+ * Replace the content of a cache file atomically
+ * 
+ * The content is written to a uniquely named temporary
+ * file, so that multiple threads and processes can write
+ * the same file at the same time, the last rename wins
+ * 
+ * @param   path  The pathname of the file
+ * @param   data  The new content
+ * @param   size  The size of `data`
+ * @return        Zero on success, -1 on error
+ */
+int
+cache_write(const char *path, const void *data, size_t size)
+{
+	char *tmp;
+	const char *p = data;
+	ssize_t r;
+	int fd, saved_errno;
+
+	tmp = malloc(strlen(path) + sizeof(".~XXXXXX"));
+	if (!tmp)
+		return -1;
+	stpcpy(stpcpy(tmp, path), ".~XXXXXX");
+
+	fd = mkstemp(tmp);
+	if (fd < 0)
+		goto fail;
+	if (fcntl(fd, F_SETFD, FD_CLOEXEC) < 0)
+		goto fail_close;
+	while (size) {
+		r = write(fd, p, size);
+		if (r < 0) {
+			if (errno == EINTR)
+				continue;
+			goto fail_close;
+		}
+		p += r;
+		size -= (size_t)r;
+	}
+	if (close(fd) < 0)
+		goto fail_unlink;
+	if (rename(tmp, path) < 0)
+		goto fail_unlink;
+
+	free(tmp);
+	return 0;
+
+fail_close:
+	saved_errno = errno;
+	close(fd);
+	errno = saved_errno;
+fail_unlink:
+	saved_errno = errno;
+	unlink(tmp);
+	errno = saved_errno;
+fail:
+	saved_errno = errno;
+	free(tmp);
+	errno = saved_errno;
+	return -1;
+}
+
+
+/**
+ * Mark a cache file as recently used
+ * 
+ * @param   path  The pathname of the file
+ * @return        Zero on success, -1 on error
+ */
+int
+cache_touch(const char *path)
+{
+	return utimensat(AT_FDCWD, path, NULL, 0);
+}
+
+
+/**
+ * Remove the least recently used files in a cache
+ * directory until their total size is within a limit
+ * 
+ * Temporary files left by `cache_write` are not counted,
+ * but they are removed if they are so old that the
+ * process that wrote them must have died
+ * 
+ * @param   dir     The pathname of the directory
+ * @param   prefix  Only files whose names start with
+ *                  this string are considered
+ * @param   limit   The maximum total size, in bytes
+ * @return          Zero on success, -1 on error
+ */
+int
+cache_evict(const char *dir, const char *prefix, uintmax_t limit)
+{
+	struct cache_file *files = NULL, *new;
+	size_t n = 0, size = 0, i, prefix_len = strlen(prefix);
+	uintmax_t total = 0;
+	struct dirent *f;
+	struct stat st;
+	int saved_errno, ret = -1;
+	time_t now = time(NULL);
+	DIR *d;
+
+	d = opendir(dir);
+	if (!d)
+		return -1;
+
+	while ((errno = 0, f = readdir(d))) {
+		if (strncmp(f->d_name, prefix, prefix_len))
+			continue;
+		if (fstatat(dirfd(d), f->d_name, &st, AT_SYMLINK_NOFOLLOW) < 0 || !S_ISREG(st.st_mode))
+			continue;
+		if (strchr(f->d_name, '~')) {
+			if (now - st.st_mtim.tv_sec > CACHE_TEMP_MAX_AGE)
+				unlinkat(dirfd(d), f->d_name, 0);
+			continue;
+		}
+		if (n == size) {
+			size = size ? size * 2 : 16;
+			new = realloc(files, size * sizeof(*files));
+			if (!new)
+				goto out;
+			files = new;
+		}
+		files[n].name = strdup(f->d_name);
+		if (!files[n].name)
+			goto out;
+		files[n].size = (uintmax_t)st.st_size;
+		files[n].sec  = st.st_mtim.tv_sec;
+		files[n].nsec = st.st_mtim.tv_nsec;
+		total += files[n++].size;
+	}
+	if (errno)
+		goto out;
+
+	if (total > limit) {
+		qsort(files, n, sizeof(*files), &cache_file_cmp);
+		for (i = 0; i < n && total > limit; i++)
+			if (!unlinkat(dirfd(d), files[i].name, 0) || errno == ENOENT)
+				total -= files[i].size;
+	}
+	ret = 0;
+
+out:
+	saved_errno = errno;
+	while (n--)
+		free(files[n].name);
+	free(files);
+	closedir(d);
+	errno = saved_errno;
+	return ret;
+}
+
+
+/**
+ * Hash data (FNV-1a)
+ * 
+ * @param   data  The data to hash
+ * @param   size  The size of `data`
+ * @param   hash  The hash of the preceding data,
+ *                `CACHE_HASH_INIT` if there is none
+ * @return        The hash of the preceding data and `data`
+ */
+uint64_t
+cache_hash(const void *data, size_t size, uint64_t hash)
+{
+	const unsigned char *p = data;
+
+	while (size--) {
+		hash ^= *p++;
+		hash *= UINT64_C(0x100000001B3);
+	}
+
+	return hash;
+}
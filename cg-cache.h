@@ -0,0 +1,87 @@
+/* See LICENSE file for copyright and license details. */
+#include <stddef.h>
+#include <stdint.h>
+
+
+
+/**
+ * The value to start `cache_hash` with
+ */
+#define CACHE_HASH_INIT UINT64_C(0xCBF29CE484222325)
+
+
+
+/**
+ * Get the pathname of a file in the program's
+ * cache directory, and create the directory
+ * 
+ * @param   env       The environment variable that names the base directory
+ * @param   fallback  Base directory, relative to $HOME, to use if `env`
+ *                    is unset or empty, `NULL` if there is none
+ * @param   name      The name of the file
+ * @return            The pathname of the file, `NULL` on error; `errno`
+ *                    is set to 0 if no base directory is available
+ */
+char *cache_pathname(const char *env, const char *fallback, const char *name);
+
+/**
+ * Map a cache file into memory
+ * 
+ * @param   path   The pathname of the file
+ * @param   sizep  Output parameter for the size of the file
+ * @return         The file's content, `NULL` if the file does
+ *                 not exist, is empty, or cannot be read
+ */
+void *cache_map(const char *path, size_t *sizep);
+
+/**
+ * Unmap a cache file mapped with `cache_map`
+ * 
+ * @param  data  The file's content
+ * @param  size  The size of the file
+ */
+void cache_unmap(void *data, size_t size);
+
+/**
+ * Replace the content of a cache file atomically
+ * 
+ * @param   path  The pathname of the file
+ * @param   data  The new content
+ * @param   size  The size of `data`
+ * @return        Zero on success, -1 on error
+ */
+int cache_write(const char *path, const void *data, size_t size);
+
+/**
+ * Mark a cache file as recently used
+ * 
+ * @param   path  The pathname of the file
+ * @return        Zero on success, -1 on error
+ */
+int cache_touch(const char *path);
+
+/**
+ * Remove the least recently used files in a cache
+ * directory until their total size is within a limit
+ * 
+ * @param   dir     The pathname of the directory
+ * @param   prefix  Only files whose names start with
+ *                  this string are considered
+ * @param   limit   The maximum total size, in bytes
+ * @return          Zero on success, -1 on error
+ */
+int cache_evict(const char *dir, const char *prefix, uintmax_t limit);
+
+/**
+ * Hash data (FNV-1a)
+ * 
+ * @param   data  The data to hash
+ * @param   size  The size of `data`
+ * @param   hash  The hash of the preceding data,
+ *                `CACHE_HASH_INIT` if there is none
+ * @return        The hash of the preceding data and `data`
+ */
+#if defined(__GNUC__)
+__attribute__((__pure__))
+#endif
+uint64_t cache_hash(const void *data, size_t size, uint64_t hash);
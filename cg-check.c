@@ -0,0 +1,241 @@
+/* See LICENSE file for copyright and license details. */
+#include "cg-base.h"
+#include "cg-kernel.h"
+
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+
+/**
+ * The number of random ramps filled per stop type
+ */
+#define RAMPS 20000
+
+/**
+ * The largest number of stops in a random ramp
+ */
+#define MAX_STOPS 4097
+
+/**
+ * The largest error, in units of the stop type,
+ * that `kernel_fill` may have for an affine kernel
+ */
+#define MAX_ERROR 1
+
+/**
+ * The name of the process
+ */
+const char *argv0 = "cg-check";
+
+/**
+ * Ramp sizes that are always checked, because
+ * `kernel_fill` has versions specialised for them
+ */
+static const size_t sizes[] = {256, 1024, 4096};
+
+/**
+ * The state of the pseudorandom number generator
+ */
+static uint64_t random_state = UINT64_C(0x9E3779B97F4A7C15);
+
+
+
+/**
+ * Get a pseudorandom number, the sequence is the
+ * same every time, so that failures can be reproduced
+ * 
+ * @return  A pseudorandom number in [0, 1)
+ */
+static double
+random_unit(void)
+{
+	random_state ^= random_state << 13;
+	random_state ^= random_state >> 7;
+	random_state ^= random_state << 17;
+	return (double)(random_state >> 11) / 9007199254740992.;
+}
+
+
+/**
+ * Fill ramps with random affine kernels, as cg-limits
+ * and cg-darkroom do, and compare them against the
+ * same kernels evaluated in double precision, there
+ * is one function per stop type, named after the
+ * member in `union libcoopgamma_ramps` for the type
+ * 
+ * @param   filter  The filter to fill, its red ramp must
+ *                  have room for `MAX_STOPS` stops, and
+ *                  its green and blue ramps must be empty
+ * @return          0 if the error is within `MAX_ERROR`, 1 otherwise
+ */
+#define X(CONST, MEMBER, MAX, TYPE)\
+	static int\
+	check_##MEMBER(libcoopgamma_filter_t *filter)\
+	{\
+		struct kernel kernels[3] = {{.reverse = 0}, {.reverse = 0}, {.reverse = 0}};\
+		TYPE *stops = filter->ramps.MEMBER.red, expected;\
+		size_t i, j, n, last, stops_n = 0, off = 0;\
+		double a, b, x;\
+		int64_t error, worst = 0;\
+		filter->depth = CONST;\
+		for (i = 0; i < RAMPS; i++) {\
+			n = i < sizeof(sizes) / sizeof(*sizes) * 4 ? sizes[i % (sizeof(sizes) / sizeof(*sizes))]\
+			                                            : 2 + (size_t)(random_unit() * (MAX_STOPS - 1));\
+			last = n - 1;\
+			b = random_unit() * 4 - 2;\
+			a = random_unit() * 4 - 2 - b;\
+			kernels[0].reverse = random_unit() < 0.5;\
+			kernels[0].n = 0;\
+			kernel_push(&kernels[0], KERNEL_AFFINE, a, b);\
+			if (random_unit() < 0.5)\
+				kernel_push(&kernels[0], KERNEL_CLIP, 0, 0);\
+			filter->ramps.MEMBER.red_size = n;\
+			kernel_fill(filter, kernels);\
+			for (j = 0; j < n; j++) {\
+				x = (double)(kernels[0].reverse ? last - j : j) / (double)last * a + b;\
+				expected = x <= 0 ? 0 : x >= 1 ? (MAX) : (TYPE)(x * (double)(MAX));\
+				error = (int64_t)stops[j] - (int64_t)expected;\
+				error = error < 0 ? -error : error;\
+				worst = error > worst ? error : worst;\
+				off += error > 0;\
+			}\
+			stops_n += n;\
+		}\
+		printf("%s: affine kernels, " #TYPE ": %zu stops, %zu off, worst error %" PRIi64 "\n",\
+		       argv0, stops_n, off, worst);\
+		if (worst > MAX_ERROR) {\
+			fprintf(stderr, "%s: affine kernels, " #TYPE ": error exceeds %i\n", argv0, MAX_ERROR);\
+			return 1;\
+		}\
+		return 0;\
+	}
+X(LIBCOOPGAMMA_UINT8,  u8,  UINT8_MAX,  uint8_t)
+X(LIBCOOPGAMMA_UINT16, u16, UINT16_MAX, uint16_t)
+#undef X
+
+
+/**
+ * Push a random kernel with powers, as cg-gamma,
+ * cg-linear, cg-darkroom, and cg-icc push
+ * 
+ * @param  kernel  The kernel, must be empty
+ */
+static void
+push_random_powers(struct kernel *kernel)
+{
+	double a, b;
+	switch ((int)(random_unit() * 5)) {
+	case 0:
+		kernel_push(kernel, KERNEL_GAMMA, exp2(random_unit() * 12 - 6), 0);
+		break;
+	case 1:
+		kernel_push(kernel, KERNEL_LINEARISE, 0, 0);
+		break;
+	case 2:
+		kernel_push(kernel, KERNEL_STANDARDISE, 0, 0);
+		break;
+	case 3:
+		kernel_push(kernel, KERNEL_CIE_SCALE, random_unit(), 0);
+		kernel_push(kernel, KERNEL_CLIP, 0, 0);
+		break;
+	default:
+		b = random_unit() - 0.5;
+		a = random_unit() * 2 - b;
+		kernel_push(kernel, KERNEL_AFFINE, a, b);
+		kernel_push(kernel, KERNEL_CLIP, 0, 0);
+		kernel_push(kernel, KERNEL_GAMMA, exp2(random_unit() * 4 - 2), 0);
+		break;
+	}
+}
+
+
+/**
+ * Fill ramps with random kernels with powers, both
+ * with `kernel_approximate` set and cleared, and
+ * check that the stops are identical, there is
+ * one function per stop type, named after the
+ * member in `union libcoopgamma_ramps` for the type
+ * 
+ * @param   filter  The filter to fill, its red ramp must
+ *                  have room for `MAX_STOPS` stops, and
+ *                  its green and blue ramps must be empty
+ * @return          0 if the stops are identical, 1 otherwise
+ */
+#define X(CONST, MEMBER, MAX, TYPE)\
+	static int\
+	check_exact_##MEMBER(libcoopgamma_filter_t *filter)\
+	{\
+		static TYPE approximated[MAX_STOPS];\
+		struct kernel kernels[3] = {{.reverse = 0}, {.reverse = 0}, {.reverse = 0}};\
+		TYPE *stops = filter->ramps.MEMBER.red;\
+		size_t i, j, n, stops_n = 0, off = 0;\
+		filter->depth = CONST;\
+		for (i = 0; i < RAMPS; i++) {\
+			n = i < sizeof(sizes) / sizeof(*sizes) * 4 ? sizes[i % (sizeof(sizes) / sizeof(*sizes))]\
+			                                            : 2 + (size_t)(random_unit() * (MAX_STOPS - 1));\
+			kernels[0].reverse = random_unit() < 0.5;\
+			kernels[0].n = 0;\
+			push_random_powers(&kernels[0]);\
+			filter->ramps.MEMBER.red_size = n;\
+			kernel_approximate = 1;\
+			kernel_fill(filter, kernels);\
+			memcpy(approximated, stops, n * sizeof(*stops));\
+			kernel_approximate = 0;\
+			kernel_fill(filter, kernels);\
+			for (j = 0; j < n; j++)\
+				off += approximated[j] != stops[j];\
+			stops_n += n;\
+		}\
+		printf("%s: approximated powers, " #TYPE ": %zu stops, %zu off\n", argv0, stops_n, off);\
+		if (off) {\
+			fprintf(stderr, "%s: approximated powers, " #TYPE ": stops differ from pow\n", argv0);\
+			return 1;\
+		}\
+		return 0;\
+	}
+X(LIBCOOPGAMMA_UINT8,  u8,  UINT8_MAX,  uint8_t)
+X(LIBCOOPGAMMA_UINT16, u16, UINT16_MAX, uint16_t)
+#undef X
+
+
+/**
+ * Check that `kernel_fill` evaluates affine
+ * kernels, for 8-bit and 16-bit stops, within
+ * `MAX_ERROR` units of double precision, and
+ * that it evaluates kernels with powers, for
+ * 8-bit and 16-bit stops, to the same stops
+ * with `fast_pow` as with `pow`
+ * 
+ * @param   argc  Not used
+ * @param   argv  The command line, `*argv` is the program name
+ * @return        0 if the check passed, 1 otherwise
+ */
+int
+main(int argc, char *argv[])
+{
+	libcoopgamma_filter_t filter;
+	int r = 0;
+
+	argv0 = argv[0];
+
+	filter.ramps.u16.red = malloc(MAX_STOPS * sizeof(*filter.ramps.u16.red));
+	if (!filter.ramps.u16.red) {
+		perror(argv0);
+		return 1;
+	}
+	filter.ramps.u16.green_size = filter.ramps.u16.blue_size = 0;
+	filter.ramps.u16.green = filter.ramps.u16.blue = NULL;
+
+	r |= check_u8(&filter);
+	r |= check_u16(&filter);
+	r |= check_exact_u8(&filter);
+	r |= check_exact_u16(&filter);
+
+	free(filter.ramps.u16.red);
+	return r;
+	(void) argc;
+}
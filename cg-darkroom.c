@@ -1,9 +1,9 @@
 /* See LICENSE file for copyright and license details. */
 #include "cg-base.h"
-
-#include <libclut.h>
+#include "cg-kernel.h"
 
 #include <errno.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -26,6 +26,12 @@ char default_class[] = PKGNAME "::cg-darkroom::standard";
  */
 const char *const *class_suffixes = (const char *const[]){NULL};
 
+/**
+ * Handler for parameter updates in resident mode
+ */
+static int update_params(int argc, char *argv[]);
+int (*const handle_update)(int argc, char *argv[]) = &update_params;
+
 
 
 /**
@@ -33,11 +39,6 @@ const char *const *class_suffixes = (const char *const[]){NULL};
  */
 static int dflag = 0;
 
-/**
- * -x: remove filter rather than adding it
- */
-static int xflag = 0;
-
 /**
  * The brilliance of the red channel
  */
@@ -52,8 +53,8 @@ void
 usage(void)
 {
 	fprintf(stderr,
-	        "usage: %s [-M method] [-S site] [-c crtc]... [-R rule] "
-	        "(-x | [-p priority] [-d] [brightness])\n",
+	        "usage: %s [-M method] [-S site] [-c crtc]... [-R rule] [-v] "
+	        "(-x | [-a] [-C] [-p priority] [-d] [-D fifo] [brightness])\n",
 	        argv0);
 	exit(1);
 }
@@ -65,7 +66,7 @@ usage(void)
  * @param   opt  The option, it is a NUL-terminate two-character
  *               string starting with either '-' or '+', if the
  *               argument is not recognised, call `usage`. This
- *               string will not be "-M", "-S", "-c", "-p", or "-R".
+ *               string will not be "-M", "-S", "-c", "-p", "-R", "-D", or "-v".
  * @param   arg  The argument associated with `opt`,
  *               `NULL` there is no next argument, if this
  *               parameter is `NULL` but needed, call `usage`
@@ -78,15 +79,25 @@ handle_opt(char *opt, char *arg)
 {
 	if (opt[0] == '-') {
 		switch (opt[1]) {
+		case 'C':
+			if (ramp_cache || remove_mode)
+				usage();
+			ramp_cache = 1;
+			break;
+		case 'a':
+			if (kernel_approximate || remove_mode)
+				usage();
+			kernel_approximate = 1;
+			break;
 		case 'd':
-			if (dflag || xflag)
+			if (dflag || remove_mode)
 				usage();
 			dflag = 1;
 			break;
 		case 'x':
-			if (xflag || dflag)
+			if (remove_mode || dflag || kernel_approximate || ramp_cache)
 				usage();
-			xflag = 1;
+			remove_mode = 1;
 			break;
 		default:
 			usage();
@@ -132,8 +143,8 @@ parse_double(double *restrict out, const char *restrict str)
 int
 handle_args(int argc, char *argv[], char *prio)
 {
-	int q = xflag + dflag;
-	if ((q > 1) || (xflag && (prio || argc)))
+	int q = remove_mode + (dflag | kernel_approximate | ramp_cache);
+	if ((q > 1) || (remove_mode && (prio || argc)))
 		usage();
 	if (argc == 1) {
 		if (parse_double(&value, argv[0]) < 0)
@@ -148,81 +159,50 @@ handle_args(int argc, char *argv[], char *prio)
 /**
  * Fill a filter
  * 
- * @param   filter  The filter to fill
- * @return          Zero on success, -1 on error
+ * @param   index  The index of the filter in `crtc_updates`
+ * @param   data   Not used
+ * @return         Zero
  */
 static int
-fill_filter(libcoopgamma_filter_t *restrict filter)
+fill_filter(size_t index, void *data)
 {
-	union libcoopgamma_ramps dramps;
-	size_t size;
-
-	if (0 <= value && value <= 1) {
-		switch (filter->depth) {
-#define X(CONST, MEMBER, MAX, TYPE)\
-		case CONST:\
-			libclut_negative(&filter->ramps.MEMBER, MAX, TYPE, 1, 0, 0);\
-			libclut_rgb_brightness(&filter->ramps.MEMBER, MAX, TYPE, 1, 0, 0);\
-			libclut_cie_brightness(&filter->ramps.MEMBER, MAX, TYPE, value, value, value);\
-			break;
-		LIST_DEPTHS
-#undef X
-		default:
-			abort();
-		}
-		return 0;
-	}
-	if (filter->depth == LIBCOOPGAMMA_DOUBLE) {
-		libclut_negative(&filter->ramps.d, (double)1, double, 1, 0, 0);
-		libclut_rgb_brightness(&filter->ramps.d, (double)1, double, 1, 0, 0);
-		libclut_cie_brightness(&filter->ramps.d, (double)1, double, value, value, value);
-		libclut_clip(&filter->ramps.d, (double)1, double, 1, 0, 0);
-		return 0;
-	}
-	if (filter->depth == LIBCOOPGAMMA_FLOAT) {
-		libclut_negative(&filter->ramps.f, (float)1, float, 1, 0, 0);
-		libclut_rgb_brightness(&filter->ramps.f, (float)1, float, 1, 0, 0);
-		libclut_cie_brightness(&filter->ramps.f, (float)1, float, value, value, value);
-		libclut_clip(&filter->ramps.f, (float)1, float, 1, 0, 0);
+	struct kernel kernels[3] = {{.reverse = 1}, {.reverse = 0}, {.reverse = 0}};
+
+	if (value == BAKED_DARKROOM_BRIGHTNESS &&
+	    kernel_fill_baked(&crtc_updates[index].filter,
+	                      (const enum baked_curve[]){BAKED_DARKROOM, BAKED_ZERO, BAKED_ZERO}))
 		return 0;
-	}  
 
-	size  = dramps.d.red_size   = filter->ramps.d.red_size;
-	size += dramps.d.green_size = filter->ramps.d.green_size;
-	size += dramps.d.blue_size  = filter->ramps.d.blue_size;
-	dramps.d.red = calloc(size, sizeof(double));
-	if (!dramps.d.red)
-		return -1;
-	dramps.d.green = dramps.d.red   + dramps.d.red_size;
-	dramps.d.blue  = dramps.d.green + dramps.d.green_size;
-
-	libclut_start_over(&dramps.d, (double)1, double, 1, 0, 0);
-	libclut_negative(&dramps.d, (double)1, double, 1, 0, 0);
-	libclut_rgb_brightness(&dramps.d, (double)1, double, 1, 0, 0);
-	libclut_cie_brightness(&dramps.d, (double)1, double, value, value, value);
-	libclut_clip(&dramps.d, (double)1, double, 1, 0, 0);
-
-	switch (filter->depth) {
-	case LIBCOOPGAMMA_UINT8:
-		libclut_translate(&filter->ramps.u8, UINT8_MAX, uint8_t, &dramps.d, (double)1, double);
-		break;
-	case LIBCOOPGAMMA_UINT16:
-		libclut_translate(&filter->ramps.u16, UINT16_MAX, uint16_t, &dramps.d, (double)1, double);
-		break;
-	case LIBCOOPGAMMA_UINT32:
-		libclut_translate(&filter->ramps.u32, UINT32_MAX, uint32_t, &dramps.d, (double)1, double);
-		break;
-	case LIBCOOPGAMMA_UINT64:
-		libclut_translate(&filter->ramps.u64, UINT64_MAX, uint64_t, &dramps.d, (double)1, double);
-		break;
-	case LIBCOOPGAMMA_FLOAT:
-	case LIBCOOPGAMMA_DOUBLE:
-	default:
-		abort();
-	}
+	kernel_push(&kernels[1], KERNEL_AFFINE, 0, 0);
+	kernel_push(&kernels[2], KERNEL_AFFINE, 0, 0);
+	if (value != 1)
+		kernel_push(&kernels[0], KERNEL_CIE_SCALE, value, 0);
+	if (value > 1)
+		kernel_push(&kernels[0], KERNEL_CLIP, 0, 0);
 
-	free(dramps.d.red);
+	kernel_fill(&crtc_updates[index].filter, kernels);
 	return 0;
+	(void) data;
+}
+
+
+/**
+ * Apply new parameters received in resident mode
+ * 
+ * @param   argc  The number of received arguments
+ * @param   argv  `NULL` terminated list of received arguments
+ * @return        0: Success
+ *                1: Invalid arguments
+ *                -1: Error, `errno` set
+ */
+static int
+update_params(int argc, char *argv[])
+{
+	double v;
+	if (argc != 1 || parse_double(&v, argv[0]) < 0)
+		return 1;
+	value = v;
+	return fill_cached_filters(&fill_filter, NULL, 0, (double []){value, kernel_approximate}, sizeof(double [2]));
 }
 
 
@@ -238,61 +218,28 @@ int
 start(void)
 {
 	int r;
-	size_t i, j;
+	size_t i;
 
-	if (xflag)
-		for (i = 0; i < filters_n; i++)
-			crtc_updates[i].filter.lifespan = LIBCOOPGAMMA_REMOVE;
-	else if (dflag)
+	if (dflag)
 		for (i = 0; i < filters_n; i++)
 			crtc_updates[i].filter.lifespan = LIBCOOPGAMMA_UNTIL_DEATH;
 	else
 		for (i = 0; i < filters_n; i++)
 			crtc_updates[i].filter.lifespan = LIBCOOPGAMMA_UNTIL_REMOVAL;
 
-	if (!xflag && (r = make_slaves()) < 0)
+	if ((r = make_slaves()) < 0 || (!kernel_approximate && (r = make_peers(0)) < 0))
 		return r;
 
-	for (i = 0, r = 1; i < filters_n; i++) {
-		if (!crtc_updates[i].master || !crtc_info[crtc_updates[i].crtc].supported)
-			continue;
-		if (!xflag && (r = fill_filter(&crtc_updates[i].filter)) < 0)
-			return r;
-		r = update_filter(i, 0);
-		if (r == -2 || (r == -1 && errno != EAGAIN))
-			return r;
-		if (crtc_updates[i].slaves) {
-			for (j = 0; crtc_updates[i].slaves[j]; j++) {
-				r = update_filter(crtc_updates[i].slaves[j], 0);
-				if (r == -2 || (r == -1 && errno != EAGAIN))
-					return r;
-			}
-		}
-	}
+	if ((r = fill_cached_filters(&fill_filter, NULL, FILL_UPDATE,
+	                             (double []){value, kernel_approximate}, sizeof(double [2]))) < 0)
+		return r;
 
-	while (r != 1)
-		if ((r = synchronise(-1)) < 0)
+	while ((r = synchronise(-1)) != 1)
+		if (r < 0)
 			return r;
 
 	if (!dflag)
 		return 0;
 
-	if (libcoopgamma_set_nonblocking(&cg, 0) < 0)
-		return -1;
-	for (;;) {
-		if (libcoopgamma_synchronise(&cg, NULL, 0, &j) < 0) {
-			switch (errno) {
-			case 0:
-				break;
-			case ENOTRECOVERABLE:
-				goto enotrecoverable;
-			default:
-				return -1;
-			}
-		}
-	}
-
-enotrecoverable:
-	pause();
-	return -1;
+	return stay_alive();
 }
@@ -0,0 +1,271 @@
+/* See LICENSE file for copyright and license details. */
+#include "cg-event.h"
+
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <errno.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+
+
+
+/**
+ * The maximum number of events
+ * handled per call to `epoll_wait`
+ */
+#define MAX_EVENTS 8
+
+
+
+/**
+ * The epoll instance, -1 if not created
+ */
+static int epoll_fd = -1;
+
+
+
+/**
+ * Create the event loop
+ * 
+ * @return  Zero on success, -1 on error
+ */
+int
+event_initialise(void)
+{
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	return epoll_fd < 0 ? -1 : 0;
+}
+
+
+/**
+ * Destroy the event loop, sources are not closed
+ */
+void
+event_destroy(void)
+{
+	if (epoll_fd >= 0)
+		close(epoll_fd);
+	epoll_fd = -1;
+}
+
+
+/**
+ * Start watching a source
+ * 
+ * @param   source  The source, `.fd`, `.events`, and `.handler`
+ *                  must be set, and it must not be deallocated
+ *                  before it is removed or the loop is destroyed
+ * @return          Zero on success, -1 on error
+ */
+int
+event_add(event_source_t *source)
+{
+	struct epoll_event event;
+
+	memset(&event, 0, sizeof(event));
+	event.events = source->events;
+	event.data.ptr = source;
+	return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, source->fd, &event);
+}
+
+
+/**
+ * Change the events a source is watched for,
+ * nothing is done if they are unchanged
+ * 
+ * @param   source  The source
+ * @param   events  The epoll events to watch for
+ * @return          Zero on success, -1 on error
+ */
+int
+event_modify(event_source_t *source, uint32_t events)
+{
+	struct epoll_event event;
+
+	if (source->events == events && !(events & EPOLLONESHOT))
+		return 0;
+
+	memset(&event, 0, sizeof(event));
+	event.events = events;
+	event.data.ptr = source;
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, source->fd, &event) < 0)
+		return -1;
+	source->events = events;
+	return 0;
+}
+
+
+/**
+ * Stop watching a source
+ * 
+ * @param   source  The source
+ * @return          Zero on success, -1 on error
+ */
+int
+event_remove(event_source_t *source)
+{
+	struct epoll_event event;
+
+	memset(&event, 0, sizeof(event));
+	return epoll_ctl(epoll_fd, EPOLL_CTL_DEL, source->fd, &event);
+}
+
+
+/**
+ * Wait for sources to become ready and call their handlers
+ * 
+ * @param   timeout  The number of milliseconds the wait may block,
+ *                   -1 if it may block forever
+ * @return           Zero on success, -1 on error, -2 on libcoopgamma
+ *                   error; on failure in a handler, remaining handlers
+ *                   are not called
+ * 
+ * @throws  EINTR   The wait was interrupted by a signal
+ * @throws  EAGAIN  The wait timed out
+ */
+int
+event_wait(int timeout)
+{
+	struct epoll_event events[MAX_EVENTS];
+	event_source_t *source;
+	int i, n, r;
+
+	n = epoll_wait(epoll_fd, events, MAX_EVENTS, timeout);
+	if (n < 0)
+		return -1;
+	if (!n) {
+		errno = EAGAIN;
+		return -1;
+	}
+
+	for (i = 0; i < n; i++) {
+		source = events[i].data.ptr;
+		if ((r = source->handler(source, events[i].events)) < 0)
+			return r;
+	}
+
+	return 0;
+}
+
+
+/**
+ * Block signals and create a source that becomes
+ * readable when any of them is received
+ * 
+ * @param   source   Output parameter for the source, `.handler`
+ *                   must be set by the caller before it is added
+ * @param   signals  0-terminated list of signals
+ * @return           Zero on success, -1 on error
+ */
+int
+event_signals(event_source_t *source, const int *signals)
+{
+	sigset_t mask;
+
+	if (sigemptyset(&mask) < 0)
+		return -1;
+	for (; *signals; signals++)
+		if (sigaddset(&mask, *signals) < 0)
+			return -1;
+	if (sigprocmask(SIG_BLOCK, &mask, NULL) < 0)
+		return -1;
+
+	source->fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+	if (source->fd < 0)
+		return -1;
+	source->events = EPOLLIN;
+	return 0;
+}
+
+
+/**
+ * Read all signals received by a signal source
+ * 
+ * @param   source  The source
+ * @return          The last received signal, 0 if none
+ *                  was received, -1 on error
+ */
+int
+event_read_signals(event_source_t *source)
+{
+	struct signalfd_siginfo info;
+	ssize_t r;
+	int signo = 0;
+
+	for (;;) {
+		r = read(source->fd, &info, sizeof(info));
+		if (r < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return signo;
+			return -1;
+		}
+		if ((size_t)r < sizeof(info))
+			return signo;
+		signo = (int)info.ssi_signo;
+	}
+}
+
+
+/**
+ * Create a source that becomes readable when a
+ * periodic timer on `CLOCK_MONOTONIC` expires
+ * 
+ * @param   source    Output parameter for the source, `.handler`
+ *                    must be set by the caller before it is added
+ * @param   first     The absolute time of the first expiration
+ * @param   interval  The time between expirations
+ * @return            Zero on success, -1 on error
+ */
+int
+event_timer(event_source_t *source, const struct timespec *first, const struct timespec *interval)
+{
+	struct itimerspec spec;
+	int saved_errno;
+
+	source->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (source->fd < 0)
+		return -1;
+	source->events = EPOLLIN;
+
+	spec.it_value = *first;
+	spec.it_interval = *interval;
+	if (timerfd_settime(source->fd, TFD_TIMER_ABSTIME, &spec, NULL) < 0) {
+		saved_errno = errno;
+		close(source->fd);
+		source->fd = -1;
+		errno = saved_errno;
+		return -1;
+	}
+	return 0;
+}
+
+
+/**
+ * Acknowledge the expirations of a timer source
+ * 
+ * @param   source  The source
+ * @return          1 if the timer has expired since the last
+ *                  call, 0 if it has not, -1 on error
+ */
+int
+event_read_timer(event_source_t *source)
+{
+	uint64_t expirations;
+	ssize_t r;
+
+	for (;;) {
+		r = read(source->fd, &expirations, sizeof(expirations));
+		if (r < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return 0;
+			return -1;
+		}
+		return (size_t)r == sizeof(expirations) && expirations > 0;
+	}
+}
@@ -0,0 +1,129 @@
+/* See LICENSE file for copyright and license details. */
+#include <stdint.h>
+#include <time.h>
+
+
+
+/**
+ * A file descriptor watched by the event loop
+ */
+typedef struct event_source
+{
+	/**
+	 * The file descriptor
+	 */
+	int fd;
+
+	/**
+	 * The epoll events the source is registered for
+	 */
+	uint32_t events;
+
+	/**
+	 * Called by `event_wait` when the source is ready
+	 * 
+	 * @param   source   The source
+	 * @param   revents  The epoll events that occurred
+	 * @return           Zero on success, -1 on error, -2
+	 *                   on libcoopgamma error
+	 */
+	int (*handler)(struct event_source *source, uint32_t revents);
+
+} event_source_t;
+
+
+
+/**
+ * Create the event loop
+ * 
+ * @return  Zero on success, -1 on error
+ */
+int event_initialise(void);
+
+/**
+ * Destroy the event loop, sources are not closed
+ */
+void event_destroy(void);
+
+/**
+ * Start watching a source
+ * 
+ * @param   source  The source, `.fd`, `.events`, and `.handler`
+ *                  must be set, and it must not be deallocated
+ *                  before it is removed or the loop is destroyed
+ * @return          Zero on success, -1 on error
+ */
+int event_add(event_source_t *source);
+
+/**
+ * Change the events a source is watched for,
+ * nothing is done if they are unchanged
+ * 
+ * @param   source  The source
+ * @param   events  The epoll events to watch for
+ * @return          Zero on success, -1 on error
+ */
+int event_modify(event_source_t *source, uint32_t events);
+
+/**
+ * Stop watching a source
+ * 
+ * @param   source  The source
+ * @return          Zero on success, -1 on error
+ */
+int event_remove(event_source_t *source);
+
+/**
+ * Wait for sources to become ready and call their handlers
+ * 
+ * @param   timeout  The number of milliseconds the wait may block,
+ *                   -1 if it may block forever
+ * @return           Zero on success, -1 on error, -2 on libcoopgamma
+ *                   error; on failure in a handler, remaining handlers
+ *                   are not called
+ * 
+ * @throws  EINTR   The wait was interrupted by a signal
+ * @throws  EAGAIN  The wait timed out
+ */
+int event_wait(int timeout);
+
+/**
+ * Block signals and create a source that becomes
+ * readable when any of them is received
+ * 
+ * @param   source   Output parameter for the source, `.handler`
+ *                   must be set by the caller before it is added
+ * @param   signals  0-terminated list of signals
+ * @return           Zero on success, -1 on error
+ */
+int event_signals(event_source_t *source, const int *signals);
+
+/**
+ * Read all signals received by a signal source
+ * 
+ * @param   source  The source
+ * @return          The last received signal, 0 if none
+ *                  was received, -1 on error
+ */
+int event_read_signals(event_source_t *source);
+
+/**
+ * Create a source that becomes readable when a
+ * periodic timer on `CLOCK_MONOTONIC` expires
+ * 
+ * @param   source    Output parameter for the source, `.handler`
+ *                    must be set by the caller before it is added
+ * @param   first     The absolute time of the first expiration
+ * @param   interval  The time between expirations
+ * @return            Zero on success, -1 on error
+ */
+int event_timer(event_source_t *source, const struct timespec *first, const struct timespec *interval);
+
+/**
+ * Acknowledge the expirations of a timer source
+ * 
+ * @param   source  The source
+ * @return          1 if the timer has expired since the last
+ *                  call, 0 if it has not, -1 on error
+ */
+int event_read_timer(event_source_t *source);
@@ -1,5 +1,6 @@
 /* See LICENSE file for copyright and license details. */
 #include "cg-base.h"
+#include "cg-kernel.h"
 
 #include <libclut.h>
 
@@ -29,6 +30,12 @@ char default_class[] = PKGNAME "::cg-gamma::standard";
  */
 const char *const *class_suffixes = (const char *const[]){NULL};
 
+/**
+ * Handler for parameter updates in resident mode
+ */
+static int update_params(int argc, char *argv[]);
+int (*const handle_update)(int argc, char *argv[]) = &update_params;
+
 
 
 /**
@@ -36,11 +43,6 @@ const char *const *class_suffixes = (const char *const[]){NULL};
  */
 static int dflag = 0;
 
-/**
- * -x: remove filter rather than adding it
- */
-static int xflag = 0;
-
 /**
  * -f: gamma listing file
  */
@@ -94,8 +96,8 @@ void
 usage(void)
 {
 	fprintf(stderr,
-	        "usage: %s [-M method] [-S site] [-c crtc]... [-R rule] "
-	        "(-x | [-p priority] [-d] [-f file | all | red green blue])\n",
+	        "usage: %s [-M method] [-S site] [-c crtc]... [-R rule] [-v] "
+	        "(-x | [-a] [-C] [-p priority] [-d] [-D fifo] [-f file | all | red green blue])\n",
 	        argv0);
 	exit(1);
 }
@@ -131,7 +133,7 @@ cleanup(int ret)
  * @param   opt  The option, it is a NUL-terminate two-character
  *               string starting with either '-' or '+', if the
  *               argument is not recognised, call `usage`. This
- *               string will not be "-M", "-S", "-c", "-p", or "-R".
+ *               string will not be "-M", "-S", "-c", "-p", "-R", "-D", or "-v".
  * @param   arg  The argument associated with `opt`,
  *               `NULL` there is no next argument, if this
  *               parameter is `NULL` but needed, call `usage`
@@ -144,15 +146,25 @@ handle_opt(char *opt, char *arg)
 {
 	if (opt[0] == '-') {
 		switch (opt[1]) {
+		case 'C':
+			if (ramp_cache || remove_mode)
+				usage();
+			ramp_cache = 1;
+			break;
+		case 'a':
+			if (kernel_approximate || remove_mode)
+				usage();
+			kernel_approximate = 1;
+			break;
 		case 'd':
-			if (dflag || xflag)
+			if (dflag || remove_mode)
 				usage();
 			dflag = 1;
 			break;
 		case 'x':
-			if (xflag || dflag)
+			if (remove_mode || dflag || kernel_approximate || ramp_cache)
 				usage();
-			xflag = 1;
+			remove_mode = 1;
 			break;
 		case 'f':
 			if (fflag || !(fflag = arg))
@@ -365,8 +377,8 @@ int
 handle_args(int argc, char *argv[], char *prio)
 {
 	int free_fflag = 0, saved_errno;
-	int q = xflag + dflag;
-	if (q > 1 || (fflag && argc) || (xflag && (fflag || argc > 0 || prio)))
+	int q = remove_mode + (dflag | kernel_approximate | ramp_cache);
+	if (q > 1 || (fflag && argc) || (remove_mode && (fflag || argc > 0 || prio)))
 		usage();
 	if (argc == 1) {
 		if (parse_double(&rgamma, argv[0]) < 0)
@@ -382,7 +394,7 @@ handle_args(int argc, char *argv[], char *prio)
 	} else if (argc) {
 		usage();
 	}
-	if (!argc && !fflag && !xflag) {
+	if (!argc && !fflag && !remove_mode) {
 		fflag = get_conf_file("gamma");
 		if (!fflag)
 			return -1;
@@ -409,14 +421,48 @@ fail:
 /**
  * Fill a filter
  * 
- * @param  filter  The filter to fill
- * @param  r       The red gamma
- * @param  g       The green gamma
- * @param  b       The blue gamma
+ * @param   index  The index of the filter in `crtc_updates`
+ * @param   data   The red, green, and blue gamma, `double[3]`,
+ *                 or `NULL` to use the gamma configured for
+ *                 the filter's CRTC
+ * @return         0: Success
+ *                 1: No gamma is configured for the CRTC
  */
-static void
-fill_filter(libcoopgamma_filter_t *restrict filter, double r, double g, double b)
+static int
+fill_filter(size_t index, void *data)
 {
+	libcoopgamma_filter_t *restrict filter = &crtc_updates[index].filter;
+	const double *gammas = data;
+	struct kernel kernels[3] = {{.reverse = 0}, {.reverse = 0}, {.reverse = 0}};
+	double r, g, b;
+	size_t j;
+
+	if (gammas) {
+		r = gammas[0];
+		g = gammas[1];
+		b = gammas[2];
+	} else {
+		for (j = 0; names[j]; j++)
+			if (!strcasecmp(filter->crtc, names[j]))
+				break;
+		if (!names[j])
+			return 1;
+		r = rgammas[j];
+		g = ggammas[j];
+		b = bgammas[j];
+	}
+
+	if (kernel_approximate) {
+		if (r != 1)
+			kernel_push(&kernels[0], KERNEL_GAMMA, r, 0);
+		if (g != 1)
+			kernel_push(&kernels[1], KERNEL_GAMMA, g, 0);
+		if (b != 1)
+			kernel_push(&kernels[2], KERNEL_GAMMA, b, 0);
+		kernel_fill(filter, kernels);
+		return 0;
+	}
+
 	switch (filter->depth) {
 #define X(CONST, MEMBER, MAX, TYPE)\
 		case CONST:\
@@ -427,6 +473,38 @@ fill_filter(libcoopgamma_filter_t *restrict filter, double r, double g, double b
 	default:
 		abort();
 	}
+	return 0;
+}
+
+
+/**
+ * Apply new parameters received in resident mode
+ * 
+ * @param   argc  The number of received arguments
+ * @param   argv  `NULL` terminated list of received arguments
+ * @return        0: Success
+ *                1: Invalid arguments
+ *                -1: Error, `errno` set
+ */
+static int
+update_params(int argc, char *argv[])
+{
+	double r, g, b, *rgb;
+	if (argc == 1) {
+		if (parse_double(&r, argv[0]) < 0)
+			return 1;
+		g = b = r;
+	} else if (argc == 3) {
+		if (parse_double(&r, argv[0]) < 0 ||
+		    parse_double(&g, argv[1]) < 0 ||
+		    parse_double(&b, argv[2]) < 0)
+			return 1;
+	} else {
+		return 1;
+	}
+	rgb = (double []){r, g, b, kernel_approximate};
+	return fill_cached_filters(&fill_filter, rgb, FILL_IDENTITY | (r == g && g == b ? FILL_SAME_CHANNELS : 0),
+	                           rgb, sizeof(double [4]));
 }
 
 
@@ -441,78 +519,37 @@ fill_filter(libcoopgamma_filter_t *restrict filter, double r, double g, double b
 int
 start(void)
 {
-	int r;
-	size_t i, j;
+	double *rgb;
+	int r, flags;
+	size_t i;
 
-	if (xflag)
-		for (i = 0; i < filters_n; i++)
-			crtc_updates[i].filter.lifespan = LIBCOOPGAMMA_REMOVE;
-	else if (dflag)
+	if (dflag)
 		for (i = 0; i < filters_n; i++)
 			crtc_updates[i].filter.lifespan = LIBCOOPGAMMA_UNTIL_DEATH;
 	else
 		for (i = 0; i < filters_n; i++)
 			crtc_updates[i].filter.lifespan = LIBCOOPGAMMA_UNTIL_REMOVAL;
 
-	if (!xflag && names && (r = make_slaves()) < 0)
+	if (!names && ((r = make_slaves()) < 0 || (!kernel_approximate && (r = make_peers(0)) < 0)))
 		return cleanup(r);
 
-	if (!names) {
-		for (i = 0, r = 1; i < filters_n; i++) {
-			if (!crtc_updates[i].master || !crtc_info[crtc_updates[i].crtc].supported)
-				continue;
-			if (!xflag)
-				fill_filter(&crtc_updates[i].filter, rgamma, ggamma, bgamma);
-			r = update_filter(i, 0);
-			if (r == -2 || (r == -1 && errno != EAGAIN))
-				return cleanup(r);
-			if (crtc_updates[i].slaves) {
-				for (j = 0; crtc_updates[i].slaves[j]; j++) {
-					r = update_filter(crtc_updates[i].slaves[j], 0);
-					if (r == -2 || (r == -1 && errno != EAGAIN))
-						return cleanup(r);
-				}
-			}
-		}
-	} else {
-		for (i = 0, r = 1; i < filters_n; i++) {
-			if (!crtc_info[crtc_updates[i].crtc].supported)
-				continue;
-			for (j = 0; names[j]; j++) {
-				if (!strcasecmp(crtc_updates[i].filter.crtc, names[j])) {
-					fill_filter(&crtc_updates[i].filter, rgammas[j], ggammas[j], bgammas[j]);
-					r = update_filter(i, 0);
-					if (r == -2 || (r == -1 && errno != EAGAIN))
-						return cleanup(r);
-					break;
-				}
-			}
-		}
-	}
+	flags = FILL_UPDATE | FILL_IDENTITY;
+	if (!names && rgamma == ggamma && ggamma == bgamma)
+		flags |= FILL_SAME_CHANNELS;
+	rgb = (double []){rgamma, ggamma, bgamma, kernel_approximate};
+	if (names)
+		r = fill_filters(&fill_filter, NULL, flags);
+	else
+		r = fill_cached_filters(&fill_filter, rgb, flags, rgb, sizeof(double [4]));
+	if (r < 0)
+		return cleanup(r);
 
-	while (r != 1)
-		if ((r = synchronise(-1)) < 0)
+	while ((r = synchronise(-1)) != 1)
+		if (r < 0)
 			return cleanup(r);
 
 	if (!dflag)
 		return cleanup(0);
 
-	if (libcoopgamma_set_nonblocking(&cg, 0) < 0)
-		return cleanup(-1);
-	for (;;) {
-		if (libcoopgamma_synchronise(&cg, NULL, 0, &j) < 0) {
-			switch (errno) {
-			case 0:
-				break;
-			case ENOTRECOVERABLE:
-				goto enotrecoverable;
-			default:
-				return cleanup(-1);
-			}
-		}
-	}
-
-enotrecoverable:
-	pause();
-	return cleanup(-1);
+	return cleanup(stay_alive());
 }
@@ -1,11 +1,16 @@
 /* See LICENSE file for copyright and license details. */
 #include "cg-base.h"
+#include "cg-cache.h"
 
 #include <libclut.h>
 
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
 #include <pwd.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -36,6 +41,162 @@
  */
 #define ICCTAB "icctab"
 
+/**
+ * The value of `struct icc_cache_header.magic`
+ */
+#define ICC_CACHE_MAGIC UINT64_C(0x6367496363524331)
+
+/**
+ * The prefix of the names of the files in the ICC profile cache
+ */
+#define ICC_CACHE_PREFIX "icc-"
+
+/**
+ * The size, in bytes, the ICC profile cache
+ * is trimmed to when files are added to it
+ */
+#ifndef ICC_CACHE_LIMIT
+# define ICC_CACHE_LIMIT ((uintmax_t)1 << 20)
+#endif
+
+/**
+ * The maximum number of threads, in addition to the
+ * main thread, `load_profiles` loads ICC profiles with
+ */
+#define LOAD_MAX_THREADS 8
+
+
+
+/**
+ * The header of a file in the ICC profile cache, it is
+ * followed by the red, green, and blue gamma ramps
+ * 
+ * All members up to and including `.blue_request`
+ * are the key, which identifies the profile
+ */
+struct icc_cache_header
+{
+	/**
+	 * `ICC_CACHE_MAGIC`
+	 */
+	uint64_t magic;
+
+	/**
+	 * The device of the ICC profile
+	 */
+	uint64_t dev;
+
+	/**
+	 * The inode of the ICC profile
+	 */
+	uint64_t ino;
+
+	/**
+	 * The size of the ICC profile
+	 */
+	uint64_t size;
+
+	/**
+	 * The modification time, in seconds,
+	 * of the ICC profile
+	 */
+	int64_t sec;
+
+	/**
+	 * The nanoseconds of the modification
+	 * time of the ICC profile
+	 */
+	int64_t nsec;
+
+	/**
+	 * The size of the red gamma ramp before
+	 * the ICC profile was parsed
+	 */
+	uint64_t red_request;
+
+	/**
+	 * The size of the green gamma ramp before
+	 * the ICC profile was parsed
+	 */
+	uint64_t green_request;
+
+	/**
+	 * The size of the blue gamma ramp before
+	 * the ICC profile was parsed
+	 */
+	uint64_t blue_request;
+
+	/**
+	 * The gamma ramp type
+	 */
+	int64_t depth;
+
+	/**
+	 * The size of the red gamma ramp
+	 */
+	uint64_t red_size;
+
+	/**
+	 * The size of the green gamma ramp
+	 */
+	uint64_t green_size;
+
+	/**
+	 * The size of the blue gamma ramp
+	 */
+	uint64_t blue_size;
+};
+
+
+/**
+ * ICC profiles loaded by `load_profiles`
+ */
+struct load_job
+{
+	/**
+	 * The indices, in `rampses`, of the ICC profiles to load
+	 */
+	size_t *indices;
+
+	/**
+	 * The return value of `load_icc` for
+	 * each profile in `.indices`
+	 */
+	int *results;
+
+	/**
+	 * The value of `errno` for each profile
+	 * in `.indices` for which `load_icc` failed
+	 */
+	int *errnos;
+
+	/**
+	 * Whether each profile in `.indices` has been loaded
+	 */
+	int *done;
+
+	/**
+	 * The number of elements in `.indices`
+	 */
+	size_t n;
+
+	/**
+	 * The next element in `.indices` to load
+	 */
+	size_t next;
+
+	/**
+	 * Mutex protecting `.next`, `.results`,
+	 * `.errnos`, and `.done`
+	 */
+	pthread_mutex_t mutex;
+
+	/**
+	 * Signalled when an element in `.done` is set
+	 */
+	pthread_cond_t cond;
+};
+
 
 
 /**
@@ -53,6 +214,11 @@ char default_class[] = PKGNAME "::cg-icc::standard";
  */
 const char *const *class_suffixes = (const char *const[]){NULL};
 
+/**
+ * Resident mode is not supported
+ */
+int (*const handle_update)(int argc, char *argv[]) = NULL;
+
 
 
 /**
@@ -60,11 +226,6 @@ const char *const *class_suffixes = (const char *const[]){NULL};
  */
 static int dflag = 0;
 
-/**
- * -x: remove filter rather than adding it
- */
-static int xflag = 0;
-
 /**
  * The panhame of the selected ICC profile
  */
@@ -91,6 +252,19 @@ static libcoopgamma_ramps_t *rampses = NULL;
  */
 static libcoopgamma_depth_t *depths = NULL;
 
+/**
+ * For each CRTC, the index of the element in `rampses`
+ * and `depths` that holds its ICC profile, that is, the
+ * first CRTC with the same ICC profile pathname
+ */
+static size_t *profiles = NULL;
+
+/**
+ * For each element in `rampses`, whether it has been
+ * loaded, but the filters using it have not been filled
+ */
+static int *unapplied = NULL;
+
 /**
  * File descriptor for configuration directory
  */
@@ -107,6 +281,18 @@ static char **crtc_icc_keys = NULL;
  */
 static char **crtc_icc_values = NULL;
 
+/**
+ * Hash table, with open addressing, over `crtc_icc_keys`;
+ * each element is one plus the index of a key in
+ * `crtc_icc_keys`, or zero if the slot is unused
+ */
+static size_t *crtc_icc_index = NULL;
+
+/**
+ * The number of slots in `crtc_icc_index`, a power of two
+ */
+static size_t crtc_icc_index_size = 0;
+
 
 
 /**
@@ -116,8 +302,8 @@ void
 usage(void)
 {
 	fprintf(stderr,
-	        "usage: %s [-M method] [-S site] [-c crtc]... [-R rule] "
-	        "(-x | [-p priority] [-d] [file])\n",
+	        "usage: %s [-M method] [-S site] [-c crtc]... [-R rule] [-v] "
+	        "(-x | [-C] [-p priority] [-d] [file])\n",
 	        argv0);
 	exit(1);
 }
@@ -142,6 +328,8 @@ cleanup(int ret)
 			libcoopgamma_ramps_destroy(rampses + i);
 	free(rampses);
 	free(depths);
+	free(profiles);
+	free(unapplied);
 	if (crtc_icc_keys)
 		for (i = 0; crtc_icc_keys[i]; i++)
 			free(crtc_icc_keys[i]);
@@ -150,6 +338,7 @@ cleanup(int ret)
 		for (i = 0; crtc_icc_values[i]; i++)
 			free(crtc_icc_values[i]);
 	free(crtc_icc_values);
+	free(crtc_icc_index);
 	errno = saved_errno;
 	return ret;
 }
@@ -161,7 +350,7 @@ cleanup(int ret)
  * @param   opt  The option, it is a NUL-terminate two-character
  *               string starting with either '-' or '+', if the
  *               argument is not recognised, call `usage`. This
- *               string will not be "-M", "-S", "-c", "-p", or "-R".
+ *               string will not be "-M", "-S", "-c", "-p", "-R", "-D", or "-v".
  * @param   arg  The argument associated with `opt`,
  *               `NULL` there is no next argument, if this
  *               parameter is `NULL` but needed, call `usage`
@@ -174,15 +363,20 @@ handle_opt(char *opt, char *arg)
 {
 	if (opt[0] == '-') {
 		switch (opt[1]) {
+		case 'C':
+			if (ramp_cache || remove_mode)
+				usage();
+			ramp_cache = 1;
+			break;
 		case 'd':
-			if (dflag || xflag)
+			if (dflag || remove_mode)
 				usage();
 			dflag = 1;
 			break;
 		case 'x':
-			if (xflag || dflag)
+			if (remove_mode || dflag || ramp_cache)
 				usage();
-			xflag = 1;
+			remove_mode = 1;
 			break;
 		default:
 			usage();
@@ -194,7 +388,62 @@ handle_opt(char *opt, char *arg)
 
 
 /**
- * Populate `crtc_icc_keys` and `crtc_icc_value`
+ * Calculate the hash of a key in `crtc_icc_keys`,
+ * which is case-insensitive, like the keys
+ * 
+ * @param   key  The key
+ * @return       The hash of the key
+ */
+static size_t
+icc_key_hash(const char *key)
+{
+	uint64_t hash = CACHE_HASH_INIT;
+	for (; *key; key++) {
+		hash ^= (unsigned char)tolower(*key);
+		hash *= UINT64_C(0x100000001B3);
+	}
+	return (size_t)(hash ^ (hash >> 32));
+}
+
+
+/**
+ * Create `crtc_icc_index` from `crtc_icc_keys`
+ * 
+ * If a key appears multiple times, the first
+ * occurrence is used, as with a linear search
+ * 
+ * @param   n  The number of elements in `crtc_icc_keys`
+ * @return     Zero on success, -1 on error
+ */
+static int
+index_icc_table(size_t n)
+{
+	size_t i, slot, mask;
+
+	/* Keep the table at most half full so probe sequences are short */
+	crtc_icc_index_size = 8;
+	while (crtc_icc_index_size / 2 < n)
+		crtc_icc_index_size <<= 1;
+	crtc_icc_index = calloc(crtc_icc_index_size, sizeof(*crtc_icc_index));
+	if (!crtc_icc_index)
+		return -1;
+	mask = crtc_icc_index_size - 1;
+
+	for (i = 0; i < n; i++) {
+		slot = icc_key_hash(crtc_icc_keys[i]) & mask;
+		for (; crtc_icc_index[slot]; slot = (slot + 1) & mask)
+			if (!strcasecmp(crtc_icc_keys[crtc_icc_index[slot] - 1], crtc_icc_keys[i]))
+				break;
+		if (!crtc_icc_index[slot])
+			crtc_icc_index[slot] = i + 1;
+	}
+
+	return 0;
+}
+
+
+/**
+ * Populate `crtc_icc_keys`, `crtc_icc_value`, and `crtc_icc_index`
  * 
  * @path    fd       File descriptor for the ICC profile table
  * @path    dirname  The dirname of the ICC profile table
@@ -243,15 +492,15 @@ load_icc_table(int fd, const char *dirname)
 			        argv0, lineno, dirname, ICCTAB, q);
 		}
 		if (ptr == siz) {
-			new = realloc(crtc_icc_keys, (siz + 5) * sizeof(*crtc_icc_keys));
+			siz = siz ? siz * 2 : 16;
+			new = realloc(crtc_icc_keys, (siz + 1) * sizeof(*crtc_icc_keys));
 			if (!new)
 				goto fail;
 			crtc_icc_keys = new;
-			new = realloc(crtc_icc_values, (siz + 5) * sizeof(*crtc_icc_values));
+			new = realloc(crtc_icc_values, (siz + 1) * sizeof(*crtc_icc_values));
 			if (!new)
 				goto fail;
 			crtc_icc_values = new;
-			siz += 4;
 		}
 		crtc_icc_values[ptr] = malloc((*q == '/' ? 1 : dirname_len + sizeof("/")) + strlen(q));
 		if (!crtc_icc_values[ptr])
@@ -274,6 +523,8 @@ load_icc_table(int fd, const char *dirname)
 		crtc_icc_keys[ptr] = NULL;
 	if (crtc_icc_values)
 		crtc_icc_values[ptr] = NULL;
+	if (index_icc_table(ptr) < 0)
+		goto fail;
 	fclose(fp);
 	free(line);
 	return 0;
@@ -305,12 +556,12 @@ handle_args(int argc, char *argv[], char *prio)
 	struct passwd *pw;
 	char *path = NULL;
 	int saved_errno;
-	int fd = -1, q = xflag + dflag;
-	if ((q > 1) || (xflag && (argc > 0 || prio)) || argc > 1)
+	int fd = -1, q = remove_mode + (dflag | ramp_cache);
+	if ((q > 1) || (remove_mode && (argc > 0 || prio)) || argc > 1)
 		usage();
 	icc_pathname = *argv;
 	memset(&uniramps, 0, sizeof(uniramps));
-	if (!xflag && !icc_pathname) {
+	if (!remove_mode && !icc_pathname) {
 		pw = getpwuid(getuid());
 		if (!pw || !pw->pw_dir)
 			goto fail;
@@ -668,9 +919,172 @@ parse_icc(const char *restrict content, size_t n, libcoopgamma_ramps_t *ramps, l
 }
 
 
+/**
+ * Get the size of a stop in a gamma ramp
+ * 
+ * @param   depth  The gamma ramp type
+ * @return         The size of a stop, in bytes,
+ *                 0 if `depth` is invalid
+ */
+static size_t
+stop_width(int64_t depth)
+{
+	switch (depth) {
+#define X(CONST, MEMBER, MAX, TYPE)\
+	case CONST:\
+		return sizeof(TYPE);
+	LIST_DEPTHS
+#undef X
+	default:
+		return 0;
+	}
+}
+
+
+/**
+ * Get the pathname of the file in the ICC profile
+ * cache for an ICC profile, and its key
+ * 
+ * @param   st     The status of the ICC profile
+ * @param   ramps  The gamma ramps the ICC profile will be parsed into
+ * @param   key    Output parameter for the key of the ICC profile,
+ *                 the members after `.blue_request` are not set
+ * @return         The pathname of the file, shall be freed by the
+ *                 caller, `NULL` on error or if there is no cache
+ */
+static char *
+icc_cache_entry(const struct stat *st, const libcoopgamma_ramps_t *ramps, struct icc_cache_header *key)
+{
+	char name[sizeof(ICC_CACHE_PREFIX) + 16];
+	uint64_t hash;
+
+	memset(key, 0, sizeof(*key));
+	key->magic         = ICC_CACHE_MAGIC;
+	key->dev           = (uint64_t)st->st_dev;
+	key->ino           = (uint64_t)st->st_ino;
+	key->size          = (uint64_t)st->st_size;
+	key->sec           = (int64_t)st->st_mtim.tv_sec;
+	key->nsec          = (int64_t)st->st_mtim.tv_nsec;
+	key->red_request   = (uint64_t)ramps->u8.red_size;
+	key->green_request = (uint64_t)ramps->u8.green_size;
+	key->blue_request  = (uint64_t)ramps->u8.blue_size;
+
+	hash = cache_hash(key, offsetof(struct icc_cache_header, depth), CACHE_HASH_INIT);
+	sprintf(name, ICC_CACHE_PREFIX "%016" PRIx64, hash);
+	return cache_pathname("XDG_CACHE_HOME", ".cache", name);
+}
+
+
+/**
+ * Load a parsed ICC profile from the ICC profile cache
+ * 
+ * @param   path   The pathname of the file in the cache
+ * @param   key    The key of the ICC profile
+ * @param   ramps  Output parameter for the filter stored in the ICC profile
+ * @param   depth  Output parameter for ramps stop value type
+ * @return         1 if the profile was loaded, 0 if it is
+ *                 not in the cache or on error
+ */
+static int
+load_icc_cache(const char *path, const struct icc_cache_header *key,
+               libcoopgamma_ramps_t *ramps, libcoopgamma_depth_t *depth)
+{
+	const struct icc_cache_header *header;
+	size_t size, n, width;
+	char *data;
+	int ret = 0;
+
+	data = cache_map(path, &size);
+	if (!data)
+		return 0;
+
+	header = (const void *)data;
+	if (size < sizeof(*header) || memcmp(header, key, offsetof(struct icc_cache_header, depth)))
+		goto out;
+	width = stop_width(header->depth);
+	n = (size - sizeof(*header)) / (width ? width : 1);
+	if (!width || header->red_size > n || header->green_size > n - header->red_size ||
+	    header->blue_size != n - header->red_size - header->green_size ||
+	    size != sizeof(*header) + n * width)
+		goto out;
+
+	ramps->u8.red_size   = (size_t)header->red_size;
+	ramps->u8.green_size = (size_t)header->green_size;
+	ramps->u8.blue_size  = (size_t)header->blue_size;
+	switch (header->depth) {
+#define X(CONST, MEMBER, MAX, TYPE)\
+	case CONST:\
+		if (libcoopgamma_ramps_initialise(&ramps->MEMBER) < 0)\
+			goto out;\
+		break;
+	LIST_DEPTHS
+#undef X
+	default:
+		goto out;
+	}
+	/* The channels are allocated in one block, in order */
+	memcpy(ramps->u8.red, &header[1], n * width);
+	*depth = (libcoopgamma_depth_t)header->depth;
+	cache_touch(path);
+	ret = 1;
+
+out:
+	cache_unmap(data, size);
+	return ret;
+}
+
+
+/**
+ * Add a parsed ICC profile to the ICC profile cache,
+ * failure is ignored
+ * 
+ * @param  path   The pathname of the file in the cache
+ * @param  key    The key of the ICC profile
+ * @param  ramps  The filter stored in the ICC profile
+ * @param  depth  The ramps stop value type
+ */
+static void
+save_icc_cache(const char *path, const struct icc_cache_header *key,
+               const libcoopgamma_ramps_t *ramps, libcoopgamma_depth_t depth)
+{
+	struct icc_cache_header *header;
+	size_t size, n;
+	char *data, *dir;
+
+	n = ramps->u8.red_size + ramps->u8.green_size + ramps->u8.blue_size;
+	size = sizeof(*header) + n * stop_width(depth);
+	data = malloc(size);
+	if (!data)
+		return;
+
+	header = (void *)data;
+	*header = *key;
+	header->depth      = (int64_t)depth;
+	header->red_size   = (uint64_t)ramps->u8.red_size;
+	header->green_size = (uint64_t)ramps->u8.green_size;
+	header->blue_size  = (uint64_t)ramps->u8.blue_size;
+	memcpy(&header[1], ramps->u8.red, size - sizeof(*header));
+
+	if (!cache_write(path, data, size)) {
+		dir = cache_pathname("XDG_CACHE_HOME", ".cache", "");
+		if (dir)
+			cache_evict(dir, ICC_CACHE_PREFIX, ICC_CACHE_LIMIT);
+		free(dir);
+	}
+	free(data);
+}
+
+
 /**
  * Load an ICC profile
  * 
+ * Regular files are mapped into memory rather than
+ * read, so that only the pages of the header, the
+ * tag table, and the used tag are read from the file
+ * 
+ * If `ramp_cache` is set, the parsed profile is looked
+ * up in, and added to, the ICC profile cache
+ * 
  * @param   file   The ICC-profile file
  * @param   ramps  Output parameter for the filter stored in the ICC profile,
  *                 `.red_size`, `.green_size`, `.blue_size` should already be
@@ -685,20 +1099,41 @@ load_icc(const char *file, libcoopgamma_ramps_t *ramps, libcoopgamma_depth_t *de
 	char *content = NULL;
 	size_t ptr = 0, size = 0;
 	ssize_t got;
-	int fd = -1, r = -1, saved_errno;
+	int fd = -1, r = -1, saved_errno, mapped = 0;
+	struct icc_cache_header key;
+	char *cache_path = NULL;
+	struct stat st;
 	size_t new_size;
 	void *new;
 
 	fd = open(file, O_RDONLY);
-	if (fd < 0) {
-		if (errno == ENOENT) {
-			fprintf(stderr, "%s: %s: %s\n", argv0, strerror(ENOENT), file);
-			errno = 0;
-		}
+	if (fd < 0)
 		goto fail;
+
+	if (fstat(fd, &st) < 0)
+		goto fail;
+	if (ramp_cache) {
+		cache_path = icc_cache_entry(&st, ramps, &key);
+		if (cache_path && load_icc_cache(cache_path, &key, ramps, depth)) {
+			r = 0;
+			goto fail;
+		}
+	}
+	if (S_ISREG(st.st_mode) && st.st_size > 0 && (uintmax_t)st.st_size <= SIZE_MAX) {
+		content = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (content != MAP_FAILED) {
+			mapped = 1;
+			ptr = size = (size_t)st.st_size;
+			/* Only a few parts of the file are used, and
+			 * vendor profiles can embed megabytes of other
+			 * tables, so do not read ahead */
+			madvise(content, size, MADV_RANDOM);
+		} else {
+			content = NULL;
+		}
 	}
 
-	for (;;) {
+	while (!mapped) {
 		if (ptr == size) {
 			new_size = size ? (size << 1) : 4098;
 			new = realloc(content, new_size);
@@ -721,16 +1156,45 @@ load_icc(const char *file, libcoopgamma_ramps_t *ramps, libcoopgamma_depth_t *de
 	close(fd), fd = -1;
 
 	r = parse_icc(content, ptr, ramps, depth);
+	if (!r && cache_path)
+		save_icc_cache(cache_path, &key, ramps, *depth);
 fail:
 	saved_errno = errno;
 	if (fd >= 0)
 		close(fd);
-	free(content);
+	if (mapped)
+		munmap(content, size);
+	else
+		free(content);
+	free(cache_path);
 	errno = saved_errno;
 	return r;
 }
 
 
+/**
+ * Report a failure to load an ICC profile
+ * 
+ * @param   file  The ICC-profile file
+ * @param   r     The value returned by `load_icc`, not 0,
+ *                `errno` shall be set as by `load_icc`
+ * @return        -1: Error, `errno` set
+ *                -3: Error, message already printed
+ */
+static int
+icc_failure(const char *file, int r)
+{
+	if (r == -2) {
+		fprintf(stderr, "%s: unusable ICC profile: %s\n", argv0, file);
+		return -3;
+	} else if (errno == ENOENT) {
+		fprintf(stderr, "%s: %s: %s\n", argv0, strerror(ENOENT), file);
+		return -3;
+	}
+	return -1;
+}
+
+
 /**
  * Get the pathname of the ICC profile for a CRTC
  * 
@@ -740,11 +1204,12 @@ fail:
 static const char *
 get_icc(const char *crtc)
 {
-	size_t i;
-	if (crtc_icc_keys)
-		for (i = 0; crtc_icc_keys[i]; i++)
-			if (!strcasecmp(crtc, crtc_icc_keys[i]))
-				return crtc_icc_values[i];
+	size_t slot, mask = crtc_icc_index_size - 1;
+	if (!crtc_icc_index)
+		return NULL;
+	for (slot = icc_key_hash(crtc) & mask; crtc_icc_index[slot]; slot = (slot + 1) & mask)
+		if (!strcasecmp(crtc, crtc_icc_keys[crtc_icc_index[slot] - 1]))
+			return crtc_icc_values[crtc_icc_index[slot] - 1];
 	return NULL;
 }
 
@@ -752,13 +1217,23 @@ get_icc(const char *crtc)
 /**
  * Fill a filter
  * 
- * @param  filter  The filter to fill
- * @param  ramps   The prototype filter
- * @param  depth   The prototype filter's stop datatype
+ * @param   index  The index of the filter in `crtc_updates`
+ * @param   data   Not used
+ * @return         0: Success
+ *                 1: No ICC profile is available for the CRTC
  */
-static void
-fill_filter(libcoopgamma_filter_t *filter, const libcoopgamma_ramps_t *ramps, libcoopgamma_depth_t depth)
+static int
+fill_filter(size_t index, void *data)
 {
+	libcoopgamma_filter_t *filter = &crtc_updates[index].filter;
+	const libcoopgamma_ramps_t *ramps = icc_pathname ? &uniramps : rampses + profiles[index];
+	libcoopgamma_depth_t depth = icc_pathname ? unidepth : depths[profiles[index]];
+
+	if (!icc_pathname && !unapplied[profiles[index]])
+		return 1;
+	if (!ramps->u8.red)
+		return 1;
+
 	switch (filter->depth) {
 #define X(CONST, MEMBER, MAX, TYPE)\
 	case CONST:\
@@ -788,6 +1263,149 @@ fill_filter(libcoopgamma_filter_t *filter, const libcoopgamma_ramps_t *ramps, li
 	default:
 		abort();
 	}
+	return 0;
+	(void) data;
+}
+
+
+/**
+ * Load an ICC profile in a job
+ * 
+ * @param  job  The job
+ * @param  i    The index of the profile in `job->indices`
+ */
+static void
+load_profile(struct load_job *job, size_t i)
+{
+	size_t index = job->indices[i];
+	int r;
+
+	r = load_icc(get_icc(crtc_updates[index].filter.crtc), rampses + index, depths + index);
+
+	pthread_mutex_lock(&job->mutex);
+	job->results[i] = r;
+	job->errnos[i] = errno;
+	job->done[i] = 1;
+	pthread_cond_broadcast(&job->cond);
+	pthread_mutex_unlock(&job->mutex);
+}
+
+
+/**
+ * Load ICC profiles until all profiles in a job are taken
+ * 
+ * @param   arg  The job, `struct load_job *`
+ * @return       `NULL`
+ */
+static void *
+load_worker(void *arg)
+{
+	struct load_job *job = arg;
+	size_t i;
+
+	for (;;) {
+		pthread_mutex_lock(&job->mutex);
+		i = job->next++;
+		pthread_mutex_unlock(&job->mutex);
+		if (i >= job->n)
+			break;
+		load_profile(job, i);
+	}
+
+	return NULL;
+}
+
+
+/**
+ * Load the ICC profiles in `rampses` concurrently, and
+ * fill and send the filters using them as soon as they
+ * are loaded, in order, so that a failure is reported for
+ * the same profile as if they were loaded one by one; the
+ * filters using the profiles before it are then sent and
+ * synchronised before this function returns
+ * 
+ * @return  0: Success
+ *          -1: Error, `errno` set
+ *          -2: Error, `cg.error` set
+ *          -3: Error, message already printed
+ */
+static int
+load_profiles(void)
+{
+	pthread_t threads[LOAD_MAX_THREADS];
+	struct load_job job;
+	size_t i, k, batch, threads_n = 0;
+	int r = 0, s, failed = 0, saved_errno;
+
+	job.indices = alloca(crtcs_n * sizeof(*job.indices));
+	job.results = alloca(crtcs_n * sizeof(*job.results));
+	job.errnos  = alloca(crtcs_n * sizeof(*job.errnos));
+	job.done    = alloca(crtcs_n * sizeof(*job.done));
+	job.n       = 0;
+	job.next    = 0;
+	for (i = 0; i < crtcs_n; i++) {
+		if (profiles[i] != i || !get_icc(crtc_updates[i].filter.crtc))
+			continue;
+		job.done[job.n] = 0;
+		job.indices[job.n++] = i;
+	}
+
+	if ((errno = pthread_mutex_init(&job.mutex, NULL)))
+		return -1;
+	if ((errno = pthread_cond_init(&job.cond, NULL))) {
+		pthread_mutex_destroy(&job.mutex);
+		return -1;
+	}
+	/* The main thread loads the profiles no thread has taken when it needs them */
+	for (; threads_n < LOAD_MAX_THREADS && threads_n + 1 < job.n; threads_n++)
+		if (pthread_create(&threads[threads_n], NULL, &load_worker, &job))
+			break;
+
+	for (k = 0; k < job.n && !r; k = batch) {
+		pthread_mutex_lock(&job.mutex);
+		if (job.next == k) {
+			job.next++;
+			pthread_mutex_unlock(&job.mutex);
+			load_profile(&job, k);
+			pthread_mutex_lock(&job.mutex);
+		}
+		while (!job.done[k])
+			pthread_cond_wait(&job.cond, &job.mutex);
+		for (batch = k; batch < job.n && job.done[batch] && !job.results[batch]; batch++)
+			unapplied[job.indices[batch]] = 1;
+		pthread_mutex_unlock(&job.mutex);
+
+		if (batch == k) {
+			errno = job.errnos[k];
+			r = icc_failure(get_icc(crtc_updates[job.indices[k]].filter.crtc), job.results[k]);
+			failed = 1;
+			break;
+		}
+		if ((s = fill_filters(&fill_filter, NULL, FILL_UPDATE)) < 0)
+			r = s;
+		for (i = k; i < batch; i++)
+			unapplied[job.indices[i]] = 0;
+		/* Send the filters, without waiting, while later profiles are loaded */
+		if (!r && (s = synchronise(0)) < 0 && errno != EAGAIN && errno != EINTR)
+			r = s;
+	}
+
+	pthread_mutex_lock(&job.mutex);
+	job.next = job.n;
+	pthread_mutex_unlock(&job.mutex);
+	while (threads_n--)
+		pthread_join(threads[threads_n], NULL);
+	pthread_cond_destroy(&job.cond);
+	pthread_mutex_destroy(&job.mutex);
+
+	if (failed) {
+		saved_errno = errno;
+		while ((s = synchronise(-1)) != 1)
+			if (s < 0)
+				return s;
+		errno = saved_errno;
+	}
+	return r;
 }
 
 
@@ -804,19 +1422,16 @@ start(void)
 {
 	int r;
 	size_t i, j;
-	const char *path;
+	const char *path, *other;
 
-	if (xflag)
-		for (i = 0; i < crtcs_n; i++)
-			crtc_updates[i].filter.lifespan = LIBCOOPGAMMA_REMOVE;
-	else if (dflag)
+	if (dflag)
 		for (i = 0; i < crtcs_n; i++)
 			crtc_updates[i].filter.lifespan = LIBCOOPGAMMA_UNTIL_DEATH;
 	else
 		for (i = 0; i < crtcs_n; i++)
 			crtc_updates[i].filter.lifespan = LIBCOOPGAMMA_UNTIL_REMOVAL;
 
-	if (!xflag && !icc_pathname)
+	if (icc_pathname)
 		if ((r = make_slaves()) < 0)
 			return cleanup(r);
 
@@ -830,15 +1445,10 @@ start(void)
 			if (uniramps.u8.blue_size  < crtc_updates[i].filter.ramps.u8.blue_size)
 				uniramps.  u8.blue_size  = crtc_updates[i].filter.ramps.u8.blue_size;
 		}
-		switch (load_icc(icc_pathname, &uniramps, &unidepth)) {
-		case 0:
-			break;
-		case -1:
-			return cleanup(-1);
-		case -2:
-			fprintf(stderr, "%s: unusable ICC profile: %s\n", argv0, icc_pathname);
-			return cleanup(-3);
-		}
+		if ((r = load_icc(icc_pathname, &uniramps, &unidepth)))
+			return cleanup(icc_failure(icc_pathname, r));
+		if ((r = fill_filters(&fill_filter, NULL, FILL_UPDATE)) < 0)
+			return cleanup(r);
 	} else {
 		rampses = calloc(crtcs_n, sizeof(*rampses));
 		if (!rampses)
@@ -846,71 +1456,48 @@ start(void)
 		depths = malloc(crtcs_n * sizeof(*depths));
 		if (!depths)
 			return cleanup(-1);
+		profiles = malloc(crtcs_n * sizeof(*profiles));
+		if (!profiles)
+			return cleanup(-1);
+		unapplied = calloc(crtcs_n, sizeof(*unapplied));
+		if (!unapplied)
+			return cleanup(-1);
+
+		/* Load each ICC profile once per gamma ramp size, as
+		 * the ramps of some profiles are calculated for the
+		 * CRTC's ramp size, and let CRTC:s with the same
+		 * profile and gamma ramp type and sizes share filters */
 		for (i = 0; i < crtcs_n; i++) {
-			rampses[i].u8.red_size   = crtc_updates[i].filter.ramps.u8.red_size;
-			rampses[i].u8.green_size = crtc_updates[i].filter.ramps.u8.green_size;
-			rampses[i].u8.blue_size  = crtc_updates[i].filter.ramps.u8.blue_size;
+			profiles[i] = i;
 			path = get_icc(crtc_updates[i].filter.crtc);
-			if (!path) {
-				/* TODO remove CRTC */
-			} else {
-				switch (load_icc(path, rampses + i, depths + i)) {
-				case 0:
+			for (j = 0; path && j < i; j++) {
+				if (profiles[j] != j || !(other = get_icc(crtc_updates[j].filter.crtc)) || strcmp(path, other))
+					continue;
+				if (crtc_updates[i].filter.ramps.u8.red_size   == crtc_updates[j].filter.ramps.u8.red_size &&
+				    crtc_updates[i].filter.ramps.u8.green_size == crtc_updates[j].filter.ramps.u8.green_size &&
+				    crtc_updates[i].filter.ramps.u8.blue_size  == crtc_updates[j].filter.ramps.u8.blue_size) {
+					profiles[i] = j;
 					break;
-				case -1:
-					return cleanup(-1);
-				case -2:
-					fprintf(stderr, "%s: unusable ICC profile: %s\n", argv0, path);
-					return cleanup(-3);
 				}
 			}
+			rampses[i].u8.red_size   = crtc_updates[i].filter.ramps.u8.red_size;
+			rampses[i].u8.green_size = crtc_updates[i].filter.ramps.u8.green_size;
+			rampses[i].u8.blue_size  = crtc_updates[i].filter.ramps.u8.blue_size;
 		}
-	}
+		if ((r = make_grouped_slaves(profiles)) < 0)
+			return cleanup(r);
 
-	for (i = 0, r = 1; i < crtcs_n; i++) {
-		if (!crtc_updates[i].master || !crtc_info[i].supported)
-			continue;
-		if (!xflag) {
-			if (icc_pathname)
-				fill_filter(&crtc_updates[i].filter, &uniramps, unidepth);
-			else
-				fill_filter(&crtc_updates[i].filter, rampses + i, depths[i]);
-		}
-		r = update_filter(i, 0);
-		if (r == -2 || (r == -1 && errno != EAGAIN))
+		/* TODO remove CRTC:s without an ICC profile */
+		if ((r = load_profiles()) < 0)
 			return cleanup(r);
-		if (crtc_updates[i].slaves) {
-			for (j = 0; crtc_updates[i].slaves[j]; j++) {
-				r = update_filter(crtc_updates[i].slaves[j], 0);
-				if (r == -2 || (r == -1 && errno != EAGAIN))
-					return cleanup(r);
-			}
-		}
 	}
 
-	while (r != 1)
-		if ((r = synchronise(-1)) < 0)
+	while ((r = synchronise(-1)) != 1)
+		if (r < 0)
 			return cleanup(r);
 
 	if (!dflag)
 		return cleanup(0);
 
-	if (libcoopgamma_set_nonblocking(&cg, 0) < 0)
-		return cleanup(-1);
-	for (;;) {
-		if (libcoopgamma_synchronise(&cg, NULL, 0, &j) < 0) {
-			switch (errno) {
-			case 0:
-				break;
-			case ENOTRECOVERABLE:
-				goto enotrecoverable;
-			default:
-				return cleanup(-1);
-			}
-		}
-	}
-
-enotrecoverable:
-	pause();
-	return cleanup(-1);
+	return cleanup(stay_alive());
 }
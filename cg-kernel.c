@@ -0,0 +1,908 @@
+/* See LICENSE file for copyright and license details. */
+#include "cg-base.h"
+#include "cg-kernel.h"
+
+#include <libclut.h>
+
+#include <float.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+
+/**
+ * 1 in Q32.32 fixed-point
+ */
+#define FIXED_ONE 4294967296.
+
+/**
+ * The largest absolute factor and offset of an
+ * affine kernel that is evaluated in fixed-point
+ */
+#define FIXED_LIMIT 1024
+
+/**
+ * The maximum value of a stop type in Q32.32
+ * fixed-point, 0 if the stop type is not
+ * evaluated in fixed-point
+ * 
+ * @param   MAX  The maximum value of the stop type
+ * @return       The maximum value in fixed-point
+ */
+#define FIXED_TOP(MAX) ((int64_t)((MAX) > 1 && (MAX) <= UINT16_MAX ? (MAX) : 0) << 32)
+
+/**
+ * Whether `fast_pow` is precise enough for a stop
+ * type, that is, if the stops are at most 16 bits
+ * or are in single precision
+ * 
+ * @param   MAX   The maximum value of the stop type
+ * @param   TYPE  The stop type
+ * @return        1 if `fast_pow` may be used, 0 otherwise
+ */
+#define APPROXIMABLE(MAX, TYPE) ((double)(MAX) > 1 ? (double)(MAX) <= UINT16_MAX : sizeof(TYPE) == sizeof(float))
+
+/**
+ * The number of stops that are evaluated at
+ * a time when `fast_pow` is used
+ */
+#define CHUNK_SIZE 256
+
+/**
+ * The largest exponent, in `KERNEL_GAMMA`,
+ * for which `fast_pow` is used
+ */
+#define APPROXIMATE_LIMIT 64
+
+/**
+ * The relative error of `fast_pow` that is assumed
+ * when bounding the error of a kernel, twice the
+ * measured bound, to leave a margin
+ */
+#define FAST_POW_ERROR 1e-7
+
+/**
+ * The largest bound, in units of the stop type, on
+ * the error of a kernel for which integer stops are
+ * evaluated with `fast_pow`, with a larger bound,
+ * too many stops would be reevaluated with `pow`
+ */
+#define APPROXIMATE_MAX_MARGIN (1. / 16)
+
+/**
+ * 2 to the power of 52, adding it to a non-negative
+ * integer less than it, places the integer in the
+ * mantissa of a double
+ */
+#define TWO_POW_52 4503599627370496.
+
+/**
+ * 1.5 times 2 to the power of 52, adding it to a
+ * double of small magnitude rounds the double
+ * to the nearest integer, and places the integer
+ * in the lower bits of the mantissa
+ */
+#define ROUNDER 6755399441055744.
+
+/**
+ * The largest absolute factor and offset of an
+ * affine kernel that is evaluated in single
+ * precision by the size-specialised functions
+ */
+#define SPECIALISED_LIMIT 2
+
+/**
+ * X-macro that lists the ramp sizes for which
+ * there are versions of the affine fill of
+ * 16-bit ramps specialised for the size
+ * 
+ * The list can be overridden with CPPFLAGS
+ */
+#ifndef LIST_SPECIALISED_SIZES
+# define LIST_SPECIALISED_SIZES\
+	X(256)\
+	X(1024)\
+	X(4096)
+#endif
+
+
+
+/**
+ * -a: evaluate powers, in `KERNEL_CIE_SCALE`,
+ * `KERNEL_GAMMA`, `KERNEL_LINEARISE`, and
+ * `KERNEL_STANDARDISE`, with a fast approximation
+ * instead of `pow`, for ramps whose stops are at
+ * most 16 bits or in single precision, integer
+ * stops are still identical to those from `pow`
+ */
+int kernel_approximate = 0;
+
+
+
+/**
+ * Append a step to a kernel, adjacent affine
+ * steps are merged into one step
+ * 
+ * @param  kernel  The kernel
+ * @param  op      The operation
+ * @param  a       The first parameter of the operation
+ * @param  b       The second parameter of the operation
+ */
+void
+kernel_push(struct kernel *kernel, enum kernel_op op, double a, double b)
+{
+	struct kernel_step *last = kernel->n ? &kernel->steps[kernel->n - 1] : NULL;
+
+	if (op == KERNEL_AFFINE && last && last->op == KERNEL_AFFINE) {
+		last->b = last->b * a + b;
+		last->a *= a;
+		return;
+	}
+	if (op == KERNEL_CLIP && last && last->op == KERNEL_CLIP)
+		return;
+
+	if (kernel->n == KERNEL_MAX_STEPS)
+		abort();
+	kernel->steps[kernel->n].op  = op;
+	kernel->steps[kernel->n].a   = a;
+	kernel->steps[kernel->n++].b = b;
+}
+
+
+/**
+ * Reinterpret the bits of a double as an integer
+ * 
+ * @param   x  The double
+ * @return     The bits of `x`
+ */
+static inline uint64_t
+bits_of(double x)
+{
+	uint64_t bits;
+	memcpy(&bits, &x, sizeof(bits));
+	return bits;
+}
+
+
+/**
+ * Reinterpret an integer as the bits of a double
+ * 
+ * @param   bits  The bits
+ * @return        The double with the bits `bits`
+ */
+static inline double
+double_of(uint64_t bits)
+{
+	double x;
+	memcpy(&x, &bits, sizeof(x));
+	return x;
+}
+
+
+/**
+ * Calculate the binary logarithm of a positive
+ * normal number, the mantissa is reduced to
+ * [1/sqrt(2), sqrt(2)] and the logarithm of
+ * the mantissa is calculated with the series
+ * log2(m) = 2/ln(2) * (t + t^3/3 + t^5/5 + ...),
+ * where t = (m - 1) / (m + 1), so |t| < 0.172
+ * and the omitted terms are less than 1e-9
+ * 
+ * There are no branches, floating-point
+ * comparisons, or integer-to-double conversions,
+ * so that the function can be inlined into
+ * vectorised loops
+ * 
+ * @param   x  The number
+ * @return     The binary logarithm of `x`
+ */
+static inline double
+fast_log2(double x)
+{
+	uint64_t bits = bits_of(x);
+	uint64_t mbits = (bits & ((UINT64_C(1) << 52) - 1)) | ((uint64_t)1023 << 52);
+	uint64_t big = mbits > bits_of(M_SQRT2);
+	double m = double_of(mbits - (big << 52));
+	double e = double_of(bits_of(TWO_POW_52) | ((bits >> 52) + big)) - (TWO_POW_52 + 1023);
+	double t = (m - 1) / (m + 1), t2 = t * t;
+	return e + t * (2 / M_LN2 + t2 * (2 / (3 * M_LN2) + t2 * (2 / (5 * M_LN2) +
+	                t2 * (2 / (7 * M_LN2) + t2 * (2 / (9 * M_LN2))))));
+}
+
+
+/**
+ * Calculate 2 to the power of a number, the number
+ * is split into an integer, which becomes the exponent
+ * of the result, and a remainder in [-1/2, 1/2], whose
+ * power is calculated with the Taylor series of the
+ * exponential function to the 8th degree, where the
+ * omitted terms are less than 2e-10
+ * 
+ * The exponent is clipped to the range of normal
+ * numbers, so results that are too small to be
+ * normal are not exact but are still less than
+ * `2 * DBL_MIN`, the exponent is clipped as an
+ * integer, as clipping floating-point values
+ * prevents vectorisation
+ * 
+ * @param   y  The number, must have a magnitude less than 2^51
+ * @return     2 to the power of `y`
+ */
+static inline double
+fast_exp2(double y)
+{
+	double t = y + ROUNDER, k = t - ROUNDER;
+	double u = (y - k) * M_LN2, p;
+	int64_t e = (int64_t)(bits_of(t) - bits_of(ROUNDER));
+	e = e < -1022 ? -1022 : e > 1023 ? 1023 : e;
+	p = 1 + u * (1 + u * (1. / 2 + u * (1. / 6 + u * (1. / 24 + u * (1. / 120 +
+	            u * (1. / 720 + u * (1. / 5040 + u * (1. / 40320))))))));
+	return p * double_of((uint64_t)(e + 1023) << 52);
+}
+
+
+/**
+ * Raise a number to a power, for exponents up to
+ * `APPROXIMATE_LIMIT`, the measured relative error
+ * is less than 2.3e-8 for results of at least 2^-16,
+ * and less than 4.6e-8 for all normal results, it
+ * is largest for the largest exponents
+ * 
+ * The error is a small fraction of a unit in a
+ * 16-bit stop or of the least significant bit of a
+ * float, but it is not zero, so a stop whose exact
+ * value is close enough to a rounding boundary could
+ * be one unit off, `fill_*` reevaluates such integer
+ * stops with `pow`
+ * 
+ * Unlike `pow`, the result is 0 for non-positive
+ * numbers, and positive subnormal numbers are
+ * treated as `DBL_MIN`
+ * 
+ * @param   x  The base
+ * @param   p  The exponent, must be positive and at
+ *             most `APPROXIMATE_LIMIT`
+ * @return     `x` to the power of `p`
+ */
+static inline double
+fast_pow(double x, double p)
+{
+	int64_t bits = (int64_t)bits_of(x), min = (int64_t)bits_of(DBL_MIN);
+	uint64_t mask = -(uint64_t)(bits > 0);
+	double r = fast_exp2(fast_log2(double_of((uint64_t)(bits < min ? min : bits))) * p);
+	return double_of(bits_of(r) & mask);
+}
+
+
+/**
+ * Select between two values depending on whether
+ * a number is greater than a threshold, without
+ * branching
+ * 
+ * The comparison is made on the bits of the numbers,
+ * which are ordered as the numbers are, except that
+ * all negative numbers are ordered below all other
+ * numbers, which is sufficient for the thresholds
+ * in `fast_linearise` and `fast_standardise`
+ * 
+ * @param   x          The number
+ * @param   threshold  The threshold, must be non-negative
+ * @param   below      The value to return if `x` is at most `threshold`
+ * @param   above      The value to return if `x` is greater than `threshold`
+ * @return             `below` or `above`
+ */
+static inline double
+fast_select(double x, double threshold, double below, double above)
+{
+	uint64_t mask = -(uint64_t)((int64_t)bits_of(x) <= (int64_t)bits_of(threshold));
+	return double_of((bits_of(above) & ~mask) | (bits_of(below) & mask));
+}
+
+
+/**
+ * Convert a value from sRGB to linear RGB, as
+ * `libclut_model_standard_to_linear1`, with `fast_pow`
+ * 
+ * @param   x  The value
+ * @return     The value in linear RGB
+ */
+static inline double
+fast_linearise(double x)
+{
+	return fast_select(x, 0.04045, x / 12.92, fast_pow((x + 0.055) / 1.055, 2.4));
+}
+
+
+/**
+ * Convert a value from linear RGB to sRGB, as
+ * `libclut_model_linear_to_standard1`, with `fast_pow`
+ * 
+ * @param   x  The value
+ * @return     The value in sRGB
+ */
+static inline double
+fast_standardise(double x)
+{
+	return fast_select(x, 0.0031308, 12.92 * x, 1.055 * fast_pow(x, 1 / 2.4) - 0.055);
+}
+
+
+/**
+ * Evaluate a kernel for one stop
+ * 
+ * @param   kernel  The kernel
+ * @param   x       The value of the stop in the identity ramp
+ * @return          The value of the stop
+ */
+static inline double
+kernel_eval(const struct kernel *restrict kernel, double x)
+{
+	const struct kernel_step *step = kernel->steps, *end = &kernel->steps[kernel->n];
+	for (; step != end; step++) {
+		switch (step->op) {
+		case KERNEL_AFFINE:
+			x = x * step->a + step->b;
+			break;
+		case KERNEL_CIE_SCALE:
+			x = libclut_model_linear_to_standard1(libclut_model_standard_to_linear1(x) * step->a);
+			break;
+		case KERNEL_CLIP:
+			x = x < 0 ? 0 : x > 1 ? 1 : x;
+			break;
+		case KERNEL_GAMMA:
+			x = pow(x, 1 / step->a);
+			break;
+		case KERNEL_LINEARISE:
+			x = libclut_model_standard_to_linear1(x);
+			break;
+		case KERNEL_STANDARDISE:
+			x = libclut_model_linear_to_standard1(x);
+			break;
+		default:
+			abort();
+		}
+	}
+	return x;
+}
+
+
+/**
+ * Evaluate a kernel for a chunk of stops, with
+ * `fast_pow` instead of `pow`
+ * 
+ * Rather than evaluating all steps for one stop
+ * at a time, each step is evaluated for all
+ * stops in the chunk, so that the loops are
+ * free from branches and can be vectorised
+ * 
+ * @param  kernel  The kernel
+ * @param  xs      The values of the stops in the identity ramp,
+ *                 will be set to the values of the stops
+ * @param  n       The number of stops in the chunk
+ */
+MULTIVERSION static void
+kernel_eval_approximate(const struct kernel *restrict kernel, double *restrict xs, size_t n)
+{
+	const struct kernel_step *step = kernel->steps, *end = &kernel->steps[kernel->n];
+	double a, b;
+	size_t i;
+	for (; step != end; step++) {
+		a = step->a;
+		b = step->b;
+		switch (step->op) {
+		case KERNEL_AFFINE:
+			for (i = 0; i < n; i++)
+				xs[i] = xs[i] * a + b;
+			break;
+		case KERNEL_CIE_SCALE:
+			for (i = 0; i < n; i++)
+				xs[i] = fast_standardise(fast_linearise(xs[i]) * a);
+			break;
+		case KERNEL_CLIP:
+			for (i = 0; i < n; i++)
+				xs[i] = xs[i] < 0 ? 0 : xs[i] > 1 ? 1 : xs[i];
+			break;
+		case KERNEL_GAMMA:
+			for (i = 0, a = 1 / a; i < n; i++)
+				xs[i] = fast_pow(xs[i], a);
+			break;
+		case KERNEL_LINEARISE:
+			for (i = 0; i < n; i++)
+				xs[i] = fast_linearise(xs[i]);
+			break;
+		case KERNEL_STANDARDISE:
+			for (i = 0; i < n; i++)
+				xs[i] = fast_standardise(xs[i]);
+			break;
+		default:
+			abort();
+		}
+	}
+}
+
+
+/**
+ * Check whether `fast_pow` may be used for a kernel
+ * 
+ * @param   kernel  The kernel
+ * @return          1 if `kernel_eval_approximate` may
+ *                  be used for the kernel, 0 otherwise
+ */
+static int
+kernel_approximable(const struct kernel *restrict kernel)
+{
+	size_t i;
+	if (!kernel_approximate)
+		return 0;
+	for (i = 0; i < kernel->n; i++)
+		if (kernel->steps[i].op == KERNEL_GAMMA && !(kernel->steps[i].a >= 1. / APPROXIMATE_LIMIT))
+			return 0;
+	return 1;
+}
+
+
+/**
+ * Bound the relative error of a power of a
+ * number that has a relative error
+ * 
+ * @param   rho  The bound on the relative error of the number
+ * @param   p    The exponent
+ * @return       The bound on the relative error of the power
+ */
+static double
+bound_pow(double rho, double p)
+{
+	return rho < 1 ? fmax(pow(1 + rho, p) - 1, 1 - pow(1 - rho, p)) : INFINITY;
+}
+
+
+/**
+ * Bound the error of a step that converts
+ * from sRGB to linear RGB, when it is evaluated
+ * with `fast_pow` and its input has an error
+ * 
+ * The function is continuous but for a gap between
+ * its branches at the threshold, so an input on the
+ * other side of the threshold than the exact input
+ * is off by at most the gap plus twice the largest
+ * slope times the error of the input, which is at
+ * most twice the relative error of the input
+ * 
+ * @param  lop    The lower bound of the exact input, set
+ *                to the lower bound of the exact output
+ * @param  hip    The upper bound of the exact input, set
+ *                to the upper bound of the exact output
+ * @param  rhop   The relative part of the bound on the error of the
+ *                input, set to that of the output
+ * @param  errp   The absolute part of the bound on the error of the
+ *                input, set to that of the output
+ */
+static void
+bound_linearise(double *restrict lop, double *restrict hip, double *restrict rhop, double *restrict errp)
+{
+	double gap = fabs(0.04045 / 12.92 - pow((0.04045 + 0.055) / 1.055, 2.4));
+	double top = fmax(fmax(fabs(*lop), fabs(*hip)) * (1 + *rhop) + *errp, 0.04045);
+	double slope = fmax(1 / 12.92, 2.4 / 1.055 * pow((top + 0.055) / 1.055, 1.4));
+	*lop = libclut_model_standard_to_linear1(*lop);
+	*hip = libclut_model_standard_to_linear1(*hip);
+	*rhop = fmax(2 * *rhop, bound_pow(*rhop, 2.4)) * (1 + FAST_POW_ERROR) + FAST_POW_ERROR;
+	*errp = 2 * slope * *errp + gap;
+}
+
+
+/**
+ * Bound the error of a step that converts
+ * from linear RGB to sRGB, when it is evaluated
+ * with `fast_pow` and its input has an error
+ * 
+ * As `bound_linearise`, but the slope is at most
+ * 12.92, and the subtraction after the power
+ * multiplies the relative error the most at
+ * the threshold
+ * 
+ * @param  lop    The lower bound of the exact input, set
+ *                to the lower bound of the exact output
+ * @param  hip    The upper bound of the exact input, set
+ *                to the upper bound of the exact output
+ * @param  rhop   The relative part of the bound on the error of the
+ *                input, set to that of the output
+ * @param  errp   The absolute part of the bound on the error of the
+ *                input, set to that of the output
+ */
+static void
+bound_standardise(double *restrict lop, double *restrict hip, double *restrict rhop, double *restrict errp)
+{
+	double gap = fabs(12.92 * 0.0031308 - (1.055 * pow(0.0031308, 1 / 2.4) - 0.055));
+	double amp = 1.055 * pow(0.0031308, 1 / 2.4);
+	amp /= amp - 0.055;
+	*lop = libclut_model_linear_to_standard1(*lop);
+	*hip = libclut_model_linear_to_standard1(*hip);
+	*rhop = (fmax(2 * *rhop, bound_pow(*rhop, 1 / 2.4)) * (1 + FAST_POW_ERROR) + FAST_POW_ERROR) * amp;
+	*errp = 2 * 12.92 * *errp + gap;
+}
+
+
+/**
+ * Bound the difference between the values that
+ * `kernel_eval_approximate` and `kernel_eval`
+ * give for a kernel, by following the range of
+ * the exact values and the bound on their error
+ * through the steps of the kernel
+ * 
+ * The bound has a relative part, which powers
+ * keep small, and an absolute part, which
+ * additions and subnormal numbers give
+ * 
+ * The inputs of the two functions must be identical,
+ * the operations other than powers are then identical
+ * until a power has been calculated, and the rounding
+ * of these operations afterwards is negligible
+ * compared to the margin in `FAST_POW_ERROR`
+ * 
+ * @param   kernel  The kernel
+ * @return          The bound, `INFINITY` if the kernel raises
+ *                  a number that may be negative to a power
+ */
+static double
+kernel_error(const struct kernel *restrict kernel)
+{
+	const struct kernel_step *step = kernel->steps, *end = &kernel->steps[kernel->n];
+	double lo = 0, hi = 1, rho = 0, err = 0, t, p;
+	for (; step != end; step++) {
+		switch (step->op) {
+		case KERNEL_AFFINE:
+		case KERNEL_CIE_SCALE:
+			if (step->op == KERNEL_CIE_SCALE)
+				bound_linearise(&lo, &hi, &rho, &err);
+			if (step->b) {
+				err += rho * fmax(fabs(lo), fabs(hi));
+				rho = 0;
+			}
+			lo = lo * step->a + step->b;
+			hi = hi * step->a + step->b;
+			if (lo > hi) {
+				t = lo;
+				lo = hi;
+				hi = t;
+			}
+			err *= fabs(step->a);
+			if (step->op == KERNEL_CIE_SCALE)
+				bound_standardise(&lo, &hi, &rho, &err);
+			break;
+		case KERNEL_CLIP:
+			lo = lo < 0 ? 0 : lo > 1 ? 1 : lo;
+			hi = hi < 0 ? 0 : hi > 1 ? 1 : hi;
+			break;
+		case KERNEL_GAMMA:
+			if (lo < 0)
+				return INFINITY;
+			p = 1 / step->a;
+			/* For exponents at most 1, |x^p - y^p| <= |x - y|^p */
+			t = p <= 1 ? pow(err, p) : p * pow(hi * (1 + rho) + err, p - 1) * err;
+			/* Subnormal inputs and results are only bounded by their magnitude */
+			err = t + 2 * pow(2 * DBL_MIN, fmin(p, 1));
+			rho = bound_pow(rho, p) * (1 + FAST_POW_ERROR) + FAST_POW_ERROR;
+			lo = pow(lo, p);
+			hi = pow(hi, p);
+			break;
+		case KERNEL_LINEARISE:
+			bound_linearise(&lo, &hi, &rho, &err);
+			break;
+		case KERNEL_STANDARDISE:
+			bound_standardise(&lo, &hi, &rho, &err);
+			break;
+		default:
+			abort();
+		}
+	}
+	return rho * fmax(fabs(lo), fabs(hi)) + err;
+}
+
+
+/**
+ * Check whether a kernel is a single affine
+ * transformation, optionally followed by clipping
+ * 
+ * @param   kernel  The kernel
+ * @param   ap      Output parameter for the factor of the transformation
+ * @param   bp      Output parameter for the offset of the transformation
+ * @return          1 if the kernel is affine, 0 otherwise
+ */
+static int
+kernel_affine(const struct kernel *restrict kernel, double *restrict ap, double *restrict bp)
+{
+	size_t i;
+	*ap = 1;
+	*bp = 0;
+	for (i = 0; i < kernel->n; i++) {
+		if (kernel->steps[i].op == KERNEL_CLIP) {
+			/* Clipping is a no-op before the transformation, as kernels
+			 * start from the identity ramp, and clipping after it is
+			 * done anyway when the stops are converted to integers */
+			continue;
+		}
+		if (kernel->steps[i].op != KERNEL_AFFINE || *ap != 1 || *bp != 0)
+			return 0;
+		*ap = kernel->steps[i].a;
+		*bp = kernel->steps[i].b;
+	}
+	if (kernel->reverse) {
+		*bp += *ap;
+		*ap = -*ap;
+	}
+	return -FIXED_LIMIT <= *ap && *ap <= FIXED_LIMIT && -FIXED_LIMIT <= *bp && *bp <= FIXED_LIMIT;
+}
+
+
+/**
+ * Fill a 16-bit ramp with an affine kernel in single
+ * precision, there is one function per size listed in
+ * `LIST_SPECIALISED_SIZES`, named after the size
+ * 
+ * As the number of stops is known at compile-time,
+ * the loop can be fully vectorised, and in single
+ * precision, twice as many stops fit in a vector as
+ * in double precision or fixed-point
+ * 
+ * @param  stops  The stops of the ramp
+ * @param  v      The value of the first stop, scaled to [0, `UINT16_MAX`]
+ * @param  step   The difference between two adjacent stops, likewise scaled
+ */
+#define X(N)\
+	MULTIVERSION static void\
+	affine_u16_##N(uint16_t *restrict stops, float v, float step)\
+	{\
+		float w;\
+		size_t i;\
+		for (i = 0; i < (N); i++) {\
+			w = v + (float)(int32_t)i * step;\
+			stops[i] = w <= 0 ? 0 : w >= (float)UINT16_MAX ? UINT16_MAX : (uint16_t)(int32_t)w;\
+		}\
+	}
+LIST_SPECIALISED_SIZES
+#undef X
+
+
+/**
+ * Fill a 16-bit ramp with an affine kernel, if there is
+ * a version specialised for the size of the ramp and
+ * single precision is precise enough for the kernel
+ * 
+ * @param   stops  The stops of the ramp
+ * @param   n      The number of stops in the ramp
+ * @param   a      The factor of the kernel
+ * @param   b      The offset of the kernel
+ * @return         1 if the ramp was filled, 0 otherwise
+ */
+static int
+affine_u16_specialised(uint16_t *restrict stops, size_t n, double a, double b)
+{
+	if (a < -SPECIALISED_LIMIT || a > SPECIALISED_LIMIT || b < -SPECIALISED_LIMIT || b > SPECIALISED_LIMIT)
+		return 0;
+	switch (n) {
+#define X(N)\
+	case N:\
+		affine_u16_##N(stops, (float)(b * UINT16_MAX), (float)(a * UINT16_MAX / ((N) - 1)));\
+		return 1;
+	LIST_SPECIALISED_SIZES
+#undef X
+	default:
+		return 0;
+	}
+}
+
+
+/**
+ * Fill a ramp with a kernel, there is one function
+ * per stop type, named after the member in
+ * `union libcoopgamma_ramps` for the type
+ * 
+ * If the stops are at most 16 bits and the kernel
+ * is affine, the stops are calculated with Q32.32
+ * fixed-point arithmetic instead of in double
+ * precision, except for common sizes of 16-bit
+ * ramps, which have versions specialised for
+ * their size that use single precision; either
+ * way, the result is at most one unit off
+ * 
+ * If `kernel_approximate` is set, the stop type
+ * is `APPROXIMABLE`, and the kernel does not
+ * raise to any power larger than
+ * `APPROXIMATE_LIMIT`, the stops are instead
+ * evaluated in chunks with `fast_pow`; integer
+ * stops whose value is within the bound from
+ * `kernel_error` of a rounding boundary are
+ * reevaluated with `pow`, so integer stops are
+ * identical to those calculated with `pow`, if
+ * the bound is more than `APPROXIMATE_MAX_MARGIN`
+ * units, `pow` is used for all stops
+ * 
+ * @param  stops   The stops of the ramp
+ * @param  n       The number of stops in the ramp
+ * @param  kernel  The kernel
+ */
+#define X(CONST, MEMBER, MAX, TYPE)\
+	static void\
+	fill_##MEMBER(TYPE *restrict stops, size_t n, const struct kernel *restrict kernel)\
+	{\
+		double x, a, b, last = n > 1 ? (double)(n - 1) : 1;\
+		double xs[CHUNK_SIZE], first, dir, y, margin = 0;\
+		unsigned char near[CHUNK_SIZE];\
+		int64_t v, step, top = FIXED_TOP(MAX);\
+		size_t i, j, m;\
+		if ((MAX) > 1 && (double)(MAX) <= (double)UINT16_MAX && kernel_affine(kernel, &a, &b)) {\
+			if (sizeof(TYPE) == sizeof(uint16_t) && affine_u16_specialised((void *)stops, n, a, b))\
+				return;\
+			v = (int64_t)(b * (double)(MAX) * FIXED_ONE);\
+			step = (int64_t)(a * (double)(MAX) / last * FIXED_ONE);\
+			for (i = 0; i < n; i++, v += step)\
+				stops[i] = v <= 0 ? 0 : v >= top ? (MAX) : (TYPE)(v >> 32);\
+			return;\
+		}\
+		if (APPROXIMABLE(MAX, TYPE) && kernel_approximable(kernel) &&\
+		    ((double)(MAX) == 1 || (margin = kernel_error(kernel) * (double)(MAX)) <= APPROXIMATE_MAX_MARGIN)) {\
+			/* Also cover the rounding when scaling to the stop type */\
+			margin += (double)(MAX) * 4 * DBL_EPSILON;\
+			dir = kernel->reverse ? -1 : 1;\
+			for (i = 0; i < n; i += m) {\
+				m = n - i < CHUNK_SIZE ? n - i : CHUNK_SIZE;\
+				first = (double)(kernel->reverse ? n - 1 - i : i);\
+				/* The same inputs as `kernel_eval` gets, as `kernel_error` requires */\
+				for (j = 0; j < m; j++)\
+					xs[j] = (first + (double)(int32_t)j * dir) / last;\
+				kernel_eval_approximate(kernel, xs, m);\
+				for (j = 0; j < m; j++) {\
+					x = xs[j];\
+					if ((double)(MAX) == 1)\
+						stops[i + j] = (TYPE)x;\
+					else\
+						stops[i + j] = x <= 0 ? 0 : x >= 1 ? (MAX) : (TYPE)(x * (double)(MAX));\
+					/* Every integer but 0 is a rounding boundary, as negative values become 0 */\
+					y = x * (double)(MAX);\
+					y = y > 0.5 ? y : 0.5;\
+					y = y < (double)(MAX) + 0.5 ? y : (double)(MAX) + 0.5;\
+					near[j] = fabs(y - ((y + ROUNDER) - ROUNDER)) <= margin;\
+				}\
+				for (j = 0; (double)(MAX) > 1 && j < m; j++) {\
+					if (near[j]) {\
+						x = kernel_eval(kernel, (first + (double)(int32_t)j * dir) / last);\
+						stops[i + j] = x <= 0 ? 0 : x >= 1 ? (MAX) : (TYPE)(x * (double)(MAX));\
+					}\
+				}\
+			}\
+			return;\
+		}\
+		for (i = 0; i < n; i++) {\
+			x = kernel_eval(kernel, (double)(kernel->reverse ? n - 1 - i : i) / last);\
+			if ((double)(MAX) == 1)\
+				stops[i] = (TYPE)x;\
+			else\
+				stops[i] = x <= 0 ? 0 : x >= 1 ? (MAX) : (TYPE)(x * (double)(MAX));\
+		}\
+	}
+LIST_DEPTHS
+#undef X
+
+
+/**
+ * Fill the gamma ramps of a filter with kernels
+ * 
+ * Integer stops are clipped to their valid
+ * range, floating-point stops are only clipped
+ * if the kernel has a `KERNEL_CLIP` step
+ * 
+ * @param  filter   The filter, its depth and ramp sizes must be set
+ * @param  kernels  The kernels for the red, green, and blue channels
+ */
+void
+kernel_fill(libcoopgamma_filter_t *filter, const struct kernel kernels[3])
+{
+	switch (filter->depth) {
+#define X(CONST, MEMBER, MAX, TYPE)\
+	case CONST:\
+		fill_##MEMBER(filter->ramps.MEMBER.red,   filter->ramps.MEMBER.red_size,   &kernels[0]);\
+		fill_##MEMBER(filter->ramps.MEMBER.green, filter->ramps.MEMBER.green_size, &kernels[1]);\
+		fill_##MEMBER(filter->ramps.MEMBER.blue,  filter->ramps.MEMBER.blue_size,  &kernels[2]);\
+		break;
+	LIST_DEPTHS
+#undef X
+	default:
+		abort();
+	}
+}
+
+
+/**
+ * Get the baked table for a curve, a ramp size, and a stop type
+ * 
+ * @param   curve  The curve, must not be `BAKED_KEEP` or `BAKED_ZERO`
+ * @param   size   The number of stops in the ramp
+ * @param   depth  The stop type
+ * @return         The stops of the table, `NULL` if the curve
+ *                 is not baked for the size and stop type
+ */
+static const void *
+baked_stops(enum baked_curve curve, size_t size, libcoopgamma_depth_t depth)
+{
+	size_t i;
+	for (i = 0; i < baked_tables_n; i++)
+		if (baked_tables[i].curve == curve && baked_tables[i].size == size && baked_tables[i].depth == depth)
+			return baked_tables[i].stops;
+	return NULL;
+}
+
+
+/**
+ * Fill a ramp with a baked curve, there is one
+ * function per stop type, named after the member
+ * in `union libcoopgamma_ramps` for the type
+ * 
+ * @param  stops  The stops of the ramp
+ * @param  n      The number of stops in the ramp
+ * @param  curve  The curve
+ * @param  table  The baked table for the curve and the stop
+ *                type, `NULL` for `BAKED_KEEP` and `BAKED_ZERO`
+ */
+#define X(CONST, MEMBER, MAX, TYPE)\
+	static void\
+	bake_##MEMBER(TYPE *restrict stops, size_t n, enum baked_curve curve, const TYPE *restrict table)\
+	{\
+		size_t i;\
+		if (curve == BAKED_KEEP)\
+			return;\
+		if (curve == BAKED_ZERO) {\
+			for (i = 0; i < n; i++)\
+				stops[i] = 0;\
+			return;\
+		}\
+		memcpy(stops, table, n * sizeof(*stops));\
+	}
+LIST_DEPTHS
+#undef X
+
+
+/**
+ * Fill the gamma ramps of a filter with baked curves,
+ * if the curves are baked for the sizes of the ramps
+ * 
+ * The stops are copied from the tables for the
+ * filter's stop type
+ * 
+ * @param   filter  The filter, its depth and ramp sizes must be set
+ * @param   curves  The curves for the red, green, and blue channels,
+ *                  channels of size 0 are ignored
+ * @return          1 if the ramps were filled, 0 if a curve is not
+ *                  baked for the size of its channel, in which
+ *                  case the ramps are not modified
+ */
+int
+kernel_fill_baked(libcoopgamma_filter_t *filter, const enum baked_curve curves[3])
+{
+	size_t sizes[3] = {filter->ramps.u8.red_size, filter->ramps.u8.green_size, filter->ramps.u8.blue_size};
+	enum baked_curve effective[3];
+	const void *tables[3];
+	size_t i;
+
+	for (i = 0; i < 3; i++) {
+		effective[i] = sizes[i] ? curves[i] : BAKED_KEEP;
+		tables[i] = NULL;
+		if (effective[i] != BAKED_KEEP && effective[i] != BAKED_ZERO)
+			if (!(tables[i] = baked_stops(effective[i], sizes[i], filter->depth)))
+				return 0;
+	}
+
+	switch (filter->depth) {
+#define X(CONST, MEMBER, MAX, TYPE)\
+	case CONST:\
+		bake_##MEMBER(filter->ramps.MEMBER.red,   sizes[0], effective[0], tables[0]);\
+		bake_##MEMBER(filter->ramps.MEMBER.green, sizes[1], effective[1], tables[1]);\
+		bake_##MEMBER(filter->ramps.MEMBER.blue,  sizes[2], effective[2], tables[2]);\
+		break;
+	LIST_DEPTHS
+#undef X
+	default:
+		abort();
+	}
+	return 1;
+}
@@ -0,0 +1,280 @@
+/* See LICENSE file for copyright and license details. */
+#include <libcoopgamma.h>
+
+#include <stddef.h>
+
+
+
+/**
+ * The maximum number of steps in a kernel
+ */
+#define KERNEL_MAX_STEPS 8
+
+/**
+ * X-macro that lists the ramp sizes for
+ * which the curves in `enum baked_curve`
+ * are baked into the programs
+ * 
+ * The list can be overridden with CPPFLAGS
+ */
+#ifndef LIST_BAKED_SIZES
+# define LIST_BAKED_SIZES\
+	X(256)\
+	X(1024)
+#endif
+
+/**
+ * The brightness `BAKED_DARKROOM` is baked
+ * for, the default brightness of cg-darkroom
+ */
+#define BAKED_DARKROOM_BRIGHTNESS 0.25
+
+/**
+ * The resolution `BAKED_SHALLOW` is baked
+ * for, the default resolution of cg-shallow
+ */
+#define BAKED_SHALLOW_RESOLUTION 2
+
+
+
+/**
+ * Per-stop operations that can be fused into a kernel,
+ * `x` is the value of the stop where 0 is the minimum
+ * and 1 is the maximum
+ */
+enum kernel_op
+{
+	/**
+	 * x = x * a + b
+	 * 
+	 * Corresponds to `libclut_rgb_brightness`
+	 * (b = 0) and `libclut_rgb_limits` (a =
+	 * contrast - brightness, b = brightness)
+	 */
+	KERNEL_AFFINE,
+
+	/**
+	 * Multiply the linear-RGB value by a,
+	 * corresponds to `libclut_cie_brightness`
+	 */
+	KERNEL_CIE_SCALE,
+
+	/**
+	 * Clip x to [0, 1], corresponds to `libclut_clip`
+	 */
+	KERNEL_CLIP,
+
+	/**
+	 * x = x^(1 / a), corresponds to `libclut_gamma`
+	 */
+	KERNEL_GAMMA,
+
+	/**
+	 * Convert x from sRGB to linear RGB,
+	 * corresponds to `libclut_linearise`
+	 */
+	KERNEL_LINEARISE,
+
+	/**
+	 * Convert x from linear RGB to sRGB,
+	 * corresponds to `libclut_standardise`
+	 */
+	KERNEL_STANDARDISE
+};
+
+
+/**
+ * A step in a kernel
+ */
+struct kernel_step
+{
+	/**
+	 * The operation
+	 */
+	enum kernel_op op;
+
+	/**
+	 * The first parameter of the operation
+	 */
+	double a;
+
+	/**
+	 * The second parameter of the operation
+	 */
+	double b;
+};
+
+
+/**
+ * A sequence of per-stop operations for a channel,
+ * that are evaluated in a single pass over the ramp
+ * 
+ * A kernel always starts from the identity ramp, so
+ * filling a ramp with a kernel corresponds to calling
+ * `libclut_start_over` (optionally followed by
+ * `libclut_negative`) and then the functions for
+ * each step, and finally converting to the depth of
+ * the ramp, without any intermediate ramp
+ */
+struct kernel
+{
+	/**
+	 * Whether to start from the reversed identity
+	 * ramp, as `libclut_negative` does
+	 */
+	int reverse;
+
+	/**
+	 * The number of elements in `steps`
+	 */
+	size_t n;
+
+	/**
+	 * The operations, in the order they are applied
+	 */
+	struct kernel_step steps[KERNEL_MAX_STEPS];
+};
+
+
+
+/**
+ * Curves that are calculated when the programs
+ * are built, for the default parameters of the
+ * programs, each for the sizes listed in
+ * `LIST_BAKED_SIZES` and for each stop type
+ * 
+ * The curves are calculated in the same way as the
+ * programs calculate them when they are not baked,
+ * so the baked curves are identical to them
+ */
+enum baked_curve
+{
+	/**
+	 * Leave the channel as is
+	 */
+	BAKED_KEEP,
+
+	/**
+	 * Set all stops in the channel to 0,
+	 * this curve is not stored in a table
+	 */
+	BAKED_ZERO,
+
+	/**
+	 * The red channel of cg-darkroom, at
+	 * `BAKED_DARKROOM_BRIGHTNESS`: a reversed
+	 * kernel with a `KERNEL_CIE_SCALE` step
+	 */
+	BAKED_DARKROOM,
+
+	/**
+	 * cg-shallow at `BAKED_SHALLOW_RESOLUTION`:
+	 * `libclut_lower_resolution`
+	 */
+	BAKED_SHALLOW,
+
+	/**
+	 * cg-negative: `libclut_negative`
+	 */
+	BAKED_NEGATIVE,
+
+	/**
+	 * The start filter of cg-linear: `libclut_linearise`
+	 */
+	BAKED_LINEARISE,
+
+	/**
+	 * The stop filter of cg-linear: `libclut_standardise`
+	 */
+	BAKED_STANDARDISE
+};
+
+
+/**
+ * A baked curve for one ramp size and stop type
+ */
+struct baked_table
+{
+	/**
+	 * The curve
+	 */
+	enum baked_curve curve;
+
+	/**
+	 * The number of stops in the table
+	 */
+	size_t size;
+
+	/**
+	 * The stop type
+	 */
+	libcoopgamma_depth_t depth;
+
+	/**
+	 * The stops, of the type `.depth`
+	 */
+	const void *stops;
+};
+
+
+
+/**
+ * The baked curves, generated by cg-bake
+ */
+extern const struct baked_table baked_tables[];
+
+/**
+ * The number of elements in `baked_tables`
+ */
+extern const size_t baked_tables_n;
+
+/**
+ * -a: evaluate powers, in `KERNEL_CIE_SCALE`,
+ * `KERNEL_GAMMA`, `KERNEL_LINEARISE`, and
+ * `KERNEL_STANDARDISE`, with a fast approximation
+ * instead of `pow`, for ramps whose stops are at
+ * most 16 bits or in single precision, integer
+ * stops are still identical to those from `pow`
+ */
+extern int kernel_approximate;
+
+
+
+/**
+ * Append a step to a kernel, adjacent affine
+ * steps are merged into one step
+ * 
+ * @param  kernel  The kernel
+ * @param  op      The operation
+ * @param  a       The first parameter of the operation
+ * @param  b       The second parameter of the operation
+ */
+void kernel_push(struct kernel *kernel, enum kernel_op op, double a, double b);
+
+/**
+ * Fill the gamma ramps of a filter with kernels
+ * 
+ * Integer stops are clipped to their valid
+ * range, floating-point stops are only clipped
+ * if the kernel has a `KERNEL_CLIP` step
+ * 
+ * @param  filter   The filter, its depth and ramp sizes must be set
+ * @param  kernels  The kernels for the red, green, and blue channels
+ */
+void kernel_fill(libcoopgamma_filter_t *filter, const struct kernel kernels[3]);
+
+/**
+ * Fill the gamma ramps of a filter with baked curves,
+ * if the curves are baked for the sizes of the ramps
+ * 
+ * The stops are copied from the tables for the
+ * filter's stop type
+ * 
+ * @param   filter  The filter, its depth and ramp sizes must be set
+ * @param   curves  The curves for the red, green, and blue channels,
+ *                  channels of size 0 are ignored
+ * @return          1 if the ramps were filled, 0 if a curve is not
+ *                  baked for the size of its channel, in which
+ *                  case the ramps are not modified
+ */
+int kernel_fill_baked(libcoopgamma_filter_t *filter, const enum baked_curve curves[3]);
@@ -1,11 +1,11 @@
 /* See LICENSE file for copyright and license details. */
 #include "cg-base.h"
-
-#include <libclut.h>
+#include "cg-kernel.h"
 
 #include <sys/stat.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <math.h>
 #include <pwd.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -29,6 +29,12 @@ char default_class[] = PKGNAME "::cg-limits::standard";
  */
 const char *const *class_suffixes = (const char *const[]){NULL};
 
+/**
+ * Handler for parameter updates in resident mode
+ */
+static int update_params(int argc, char *argv[]);
+int (*const handle_update)(int argc, char *argv[]) = &update_params;
+
 
 
 /**
@@ -36,11 +42,6 @@ const char *const *class_suffixes = (const char *const[]){NULL};
  */
 static int dflag = 0;
 
-/**
- * -x: remove filter rather than adding it
- */
-static int xflag = 0;
-
 /**
  * -B: brightness listing file
  */
@@ -138,7 +139,7 @@ void
 usage(void)
 {
 	fprintf(stderr,
-	        "usage: %s [-M method] [-S site] [-c crtc]... [-R rule] (-x | [-p priority] [-d] "
+	        "usage: %s [-M method] [-S site] [-c crtc]... [-R rule] [-v] (-x | [-p priority] [-d] [-D fifo] "
 	        "([-B brightness-file] [-C contrast-file] | brightness-all:contrast-all | "
 	        "brightness-red:contrast-red brightness-green:contrast-green brightness-blue:contrast-blue))\n",
 	        argv0);
@@ -182,7 +183,7 @@ cleanup(int ret)
  * @param   opt  The option, it is a NUL-terminate two-character
  *               string starting with either '-' or '+', if the
  *               argument is not recognised, call `usage`. This
- *               string will not be "-M", "-S", "-c", "-p", or "-R".
+ *               string will not be "-M", "-S", "-c", "-p", "-R", "-D", or "-v".
  * @param   arg  The argument associated with `opt`,
  *               `NULL` there is no next argument, if this
  *               parameter is `NULL` but needed, call `usage`
@@ -196,14 +197,14 @@ handle_opt(char *opt, char *arg)
 	if (opt[0] == '-') {
 		switch (opt[1]) {
 		case 'd':
-			if (dflag || xflag)
+			if (dflag || remove_mode)
 				usage();
 			dflag = 1;
 			break;
 		case 'x':
-			if (xflag || dflag)
+			if (remove_mode || dflag)
 				usage();
-			xflag = 1;
+			remove_mode = 1;
 			break;
 		case 'B':
 			if (Bflag || !(Bflag = arg))
@@ -476,8 +477,8 @@ int
 handle_args(int argc, char *argv[], char *prio)
 {
 	int free_Bflag = 0, free_Cflag = 0, saved_errno;
-	int q = xflag + dflag;
-	if (q > 1 || (xflag && (Bflag || Cflag || argc > 0 || prio)))
+	int q = remove_mode + dflag;
+	if (q > 1 || (remove_mode && (Bflag || Cflag || argc > 0 || prio)))
 		usage();
 	if ((Bflag || Cflag) && argc)
 		usage();
@@ -498,7 +499,7 @@ handle_args(int argc, char *argv[], char *prio)
 		usage();
 	}
 
-	if (!argc && !Bflag && !xflag) {
+	if (!argc && !Bflag && !remove_mode) {
 		Bflag = get_conf_file("brightness");
 		if (!Bflag)
 			return -1;
@@ -511,7 +512,7 @@ handle_args(int argc, char *argv[], char *prio)
 		Bflag = NULL;
 	}
 
-	if (!argc && !Cflag && !xflag) {
+	if (!argc && !Cflag && !remove_mode) {
 		Cflag = get_conf_file("contrast");
 		if (!Cflag)
 			return -1;
@@ -543,69 +544,101 @@ fail:
 /**
  * Fill a filter
  * 
- * @param   filter  The filter to fill
- * @param   rb      The red brightness
- * @param   rc      The red contrast
- * @param   gb      The green brightness
- * @param   gc      The green contrast
- * @param   bb      The blue brightness
- * @param   bc      The blue contrast
- * @return          Zero on success, -1 on error
+ * @param   index  The index of the filter in `crtc_updates`
+ * @param   data   The red brightness, red contrast, green brightness,
+ *                 green contrast, blue brightness, and blue contrast,
+ *                 `double[6]`, or `NULL` to use the brightness and
+ *                 contrast configured for the filter's CRTC
+ * @return         0: Success
+ *                 1: Neither brightness nor contrast is configured
+ *                    for the CRTC
  */
 static int
-fill_filter(libcoopgamma_filter_t *restrict filter, double rb, double rc, double gb, double gc, double bb, double bc)
+fill_filter(size_t index, void *data)
 {
-	union libcoopgamma_ramps dramps;
-	size_t size;
-  
-	if (filter->depth == LIBCOOPGAMMA_DOUBLE) {
-		libclut_rgb_limits(&filter->ramps.d, (double)1, double, rb, rc, gb, gc, bb, bc);
-		libclut_clip(&filter->ramps.d, (double)1, double, 1, 1, 1);
-		return 0;
-	}
-	if (filter->depth == LIBCOOPGAMMA_FLOAT) {
-		libclut_rgb_limits(&filter->ramps.f, (float)1, float, rb, rc, gb, gc, bb, bc);
-		libclut_clip(&filter->ramps.f, (float)1, float, 1, 1, 1);
-		return 0;
+	libcoopgamma_filter_t *restrict filter = &crtc_updates[index].filter;
+	const double *limits = data;
+	struct kernel kernels[3] = {{.reverse = 0}, {.reverse = 0}, {.reverse = 0}};
+	size_t j, k;
+	char *empty = NULL;
+	char **bnames, **cnames;
+	double rb, rc, gb, gc, bb, bc;
+
+	if (limits) {
+		rb = limits[0];
+		rc = limits[1];
+		gb = limits[2];
+		gc = limits[3];
+		bb = limits[4];
+		bc = limits[5];
+	} else {
+		bnames = brightness_names ? brightness_names : &empty;
+		cnames = contrast_names ? contrast_names : &empty;
+		for (j = 0; bnames[j]; j++)
+			if (!strcasecmp(filter->crtc, bnames[j]))
+				break;
+		for (k = 0; cnames[k]; k++)
+			if (!strcasecmp(filter->crtc, cnames[k]))
+				break;
+		if (!bnames[j] && !cnames[k])
+			return 1;
+		rb = gb = bb = 0;
+		rc = bc = gc = 1;
+		if (bnames[j]) {
+			rb = rbrightnesses[j];
+			gb = gbrightnesses[j];
+			bb = bbrightnesses[j];
+		}
+		if (cnames[k]) {
+			rc = rcontrasts[k];
+			gc = gcontrasts[k];
+			bc = bcontrasts[k];
+		}
 	}
 
-	size  = dramps.d.red_size   = filter->ramps.d.red_size;
-	size += dramps.d.green_size = filter->ramps.d.green_size;
-	size += dramps.d.blue_size  = filter->ramps.d.blue_size;
-	dramps.d.red = calloc(size, sizeof(double));
-	if (!dramps.d.red)
-		return -1;
-	dramps.d.green = dramps.d.red   + dramps.d.red_size;
-	dramps.d.blue  = dramps.d.green + dramps.d.green_size;
-
-	libclut_start_over(&dramps.d, (double)1, double, 1, 1, 1);
-	libclut_rgb_limits(&dramps.d, (double)1, double, rb, rc, gb, gc, bb, bc);
-	libclut_clip(&dramps.d, (double)1, double, 1, 1, 1);
-
-	switch (filter->depth) {
-	case LIBCOOPGAMMA_UINT8:
-		libclut_translate(&filter->ramps.u8, UINT8_MAX, uint8_t, &dramps.d, (double)1, double);
-		break;
-	case LIBCOOPGAMMA_UINT16:
-		libclut_translate(&filter->ramps.u16, UINT16_MAX, uint16_t, &dramps.d, (double)1, double);
-		break;
-	case LIBCOOPGAMMA_UINT32:
-		libclut_translate(&filter->ramps.u32, UINT32_MAX, uint32_t, &dramps.d, (double)1, double);
-		break;
-	case LIBCOOPGAMMA_UINT64:
-		libclut_translate(&filter->ramps.u64, UINT64_MAX, uint64_t, &dramps.d, (double)1, double);
-		break;
-	case LIBCOOPGAMMA_FLOAT:
-	case LIBCOOPGAMMA_DOUBLE:
-	default:
-		abort();
-	}
+	kernel_push(&kernels[0], KERNEL_AFFINE, rc - rb, rb);
+	kernel_push(&kernels[1], KERNEL_AFFINE, gc - gb, gb);
+	kernel_push(&kernels[2], KERNEL_AFFINE, bc - bb, bb);
+	for (j = 0; j < 3; j++)
+		kernel_push(&kernels[j], KERNEL_CLIP, 0, 0);
 
-	free(dramps.d.red);
+	kernel_fill(filter, kernels);
 	return 0;
 }
 
 
+/**
+ * Apply new parameters received in resident mode
+ * 
+ * @param   argc  The number of received arguments
+ * @param   argv  `NULL` terminated list of received arguments
+ * @return        0: Success
+ *                1: Invalid arguments
+ *                -1: Error, `errno` set
+ */
+static int
+update_params(int argc, char *argv[])
+{
+	double rb, rc, gb, gc, bb, bc;
+	int same;
+	if (argc == 1) {
+		if (parse_twidouble(&rb, &rc, argv[0]) < 0)
+			return 1;
+		bb = gb = rb;
+		bc = gc = rc;
+	} else if (argc == 3) {
+		if (parse_twidouble(&rb, &rc, argv[0]) < 0 ||
+		    parse_twidouble(&gb, &gc, argv[1]) < 0 ||
+		    parse_twidouble(&bb, &bc, argv[2]) < 0)
+			return 1;
+	} else {
+		return 1;
+	}
+	same = rb == gb && gb == bb && rc == gc && gc == bc ? FILL_SAME_CHANNELS : 0;
+	return fill_filters(&fill_filter, (double []){rb, rc, gb, gc, bb, bc}, same);
+}
+
+
 /**
  * The main function for the program-specific code
  * 
@@ -617,102 +650,37 @@ fill_filter(libcoopgamma_filter_t *restrict filter, double rb, double rc, double
 int
 start(void)
 {
-	int r;
-	size_t i, j, k;
-	char *empty = NULL;
-	char **bnames, **cnames;
-	double rb, gb, bb, rc, bc, gc;
+	int r, same;
+	size_t i;
 
-	if (xflag)
-		for (i = 0; i < filters_n; i++)
-			crtc_updates[i].filter.lifespan = LIBCOOPGAMMA_REMOVE;
-	else if (dflag)
+	if (dflag)
 		for (i = 0; i < filters_n; i++)
 			crtc_updates[i].filter.lifespan = LIBCOOPGAMMA_UNTIL_DEATH;
 	else
 		for (i = 0; i < filters_n; i++)
 			crtc_updates[i].filter.lifespan = LIBCOOPGAMMA_UNTIL_REMOVAL;
 
-	if (!xflag && (brightness_names || contrast_names))
+	if (!brightness_names && !contrast_names)
 		if ((r = make_slaves()) < 0)
 			return cleanup(r);
 
-	if (!brightness_names && !contrast_names) {
-		for (i = 0, r = 1; i < filters_n; i++) {
-			if (!crtc_updates[i].master || !crtc_info[crtc_updates[i].crtc].supported)
-				continue;
-			if (!xflag)
-				if ((r = fill_filter(&crtc_updates[i].filter, rbrightness, rcontrast,
-				                     gbrightness, gcontrast, bbrightness, bcontrast)) < 0)
-					return cleanup(r);
-			r = update_filter(i, 0);
-			if (r == -2 || (r == -1 && errno != EAGAIN))
-				return cleanup(r);
-			if (crtc_updates[i].slaves) {
-				for (j = 0; crtc_updates[i].slaves[j]; j++) {
-					r = update_filter(crtc_updates[i].slaves[j], 0);
-					if (r == -2 || (r == -1 && errno != EAGAIN))
-						return cleanup(r);
-				}
-			}
-		}
-	} else {
-		bnames = brightness_names ? brightness_names : &empty;
-		cnames = contrast_names ? contrast_names : &empty;
-		for (i = 0, r = 1; i < filters_n; i++) {
-			if (!crtc_info[crtc_updates[i].crtc].supported)
-				continue;
-			for (j = 0; bnames[j]; j++)
-				if (!strcasecmp(crtc_updates[i].filter.crtc, bnames[j]))
-					break;
-			for (k = 0; cnames[k]; k++)
-				if (!strcasecmp(crtc_updates[i].filter.crtc, cnames[k]))
-					break;
-			if (bnames[j] || cnames[k]) {
-				rb = gb = bb = 0;
-				rc = bc = gc = 1;
-				if (bnames[j]) {
-					rb = rbrightnesses[j];
-					gb = gbrightnesses[j];
-					bb = bbrightnesses[j];
-				}
-				if (cnames[j]) {
-					rc = rcontrasts[j];
-					gc = gcontrasts[j];
-					bc = bcontrasts[j];
-				}
-				if ((r = fill_filter(&crtc_updates[i].filter, rb, rc, gb, gc, bb, bc)) < 0)
-					return cleanup(r);
-				r = update_filter(i, 0);
-				if (r == -2 || (r == -1 && errno != EAGAIN))
-					return cleanup(r);
-			}
-		}
-	}
+	same = rbrightness == gbrightness && gbrightness == bbrightness &&
+	       rcontrast == gcontrast && gcontrast == bcontrast ? FILL_SAME_CHANNELS : 0;
 
-	while (r != 1)
-		if ((r = synchronise(-1)) < 0)
+	if (brightness_names || contrast_names)
+		r = fill_filters(&fill_filter, NULL, FILL_UPDATE);
+	else
+		r = fill_filters(&fill_filter, (double []){rbrightness, rcontrast, gbrightness,
+		                                           gcontrast, bbrightness, bcontrast}, FILL_UPDATE | same);
+	if (r < 0)
+		return cleanup(r);
+
+	while ((r = synchronise(-1)) != 1)
+		if (r < 0)
 			return cleanup(r);
 
 	if (!dflag)
 		return cleanup(0);
 
-	if (libcoopgamma_set_nonblocking(&cg, 0) < 0)
-		return cleanup(-1);
-	for (;;) {
-		if (libcoopgamma_synchronise(&cg, NULL, 0, &j) < 0) {
-			switch (errno) {
-			case 0:
-				break;
-			case ENOTRECOVERABLE:
-				goto enotrecoverable;
-			default:
-				return cleanup(-1);
-			}
-		}
-	}
-
-enotrecoverable:
-	pause();
-	return cleanup(-1);
+	return cleanup(stay_alive());
 }
@@ -1,5 +1,6 @@
 /* See LICENSE file for copyright and license details. */
 #include "cg-base.h"
+#include "cg-kernel.h"
 
 #include <libclut.h>
 
@@ -26,6 +27,12 @@ char default_class[] = PKGNAME "::cg-linear::standard";
  */
 const char *const *class_suffixes = (const char *const[]){":start", ":stop", NULL};
 
+/**
+ * Handler for parameter updates in resident mode
+ */
+static int update_params(int argc, char *argv[]);
+int (*const handle_update)(int argc, char *argv[]) = &update_params;
+
 
 
 /**
@@ -33,11 +40,6 @@ const char *const *class_suffixes = (const char *const[]){":start", ":stop", NUL
  */
 static int dflag = 0;
 
-/**
- * -x: remove filter rather than adding it
- */
-static int xflag = 0;
-
 /**
  * +r: do not touch the red channel
  */
@@ -72,8 +74,8 @@ void
 usage(void)
 {
 	fprintf(stderr,
-	        "usage: %s [-M method] [-S site] [-c crtc]... [-R rule-base] "
-	        "(-x | -p start-priority:stop-priority [-d] [+rgb])\n",
+	        "usage: %s [-M method] [-S site] [-c crtc]... [-R rule-base] [-v] "
+	        "(-x | [-a] [-C] -p start-priority:stop-priority [-d] [-D fifo] [+rgb])\n",
 	        argv0);
 	exit(1);
 }
@@ -85,7 +87,7 @@ usage(void)
  * @param   opt  The option, it is a NUL-terminate two-character
  *               string starting with either '-' or '+', if the
  *               argument is not recognised, call `usage`. This
- *               string will not be "-M", "-S", "-c", "-p", or "-R".
+ *               string will not be "-M", "-S", "-c", "-p", "-R", "-D", or "-v".
  * @param   arg  The argument associated with `opt`,
  *               `NULL` there is no next argument, if this
  *               parameter is `NULL` but needed, call `usage`
@@ -98,15 +100,25 @@ handle_opt(char *opt, char *arg)
 {
 	if (opt[0] == '-') {
 		switch (opt[1]) {
+		case 'C':
+			if (ramp_cache || remove_mode)
+				usage();
+			ramp_cache = 1;
+			break;
+		case 'a':
+			if (kernel_approximate || remove_mode)
+				usage();
+			kernel_approximate = 1;
+			break;
 		case 'd':
-			if (dflag || xflag)
+			if (dflag || remove_mode)
 				usage();
 			dflag = 1;
 			break;
 		case 'x':
-			if (xflag || dflag)
+			if (remove_mode || dflag || kernel_approximate || ramp_cache)
 				usage();
-			xflag = 1;
+			remove_mode = 1;
 			break;
 		default:
 			usage();
@@ -149,11 +161,11 @@ handle_opt(char *opt, char *arg)
 int
 handle_args(int argc, char *argv[], char *prio)
 {
-	int q = xflag + (dflag | rplus | gplus | bplus);
+	int q = remove_mode + (dflag | rplus | gplus | bplus | kernel_approximate | ramp_cache);
 	char *p, *end;
-	if (argc || q > 1 || (xflag && prio))
+	if (argc || q > 1 || (remove_mode && prio))
 		usage();
-	if (!xflag && !prio)
+	if (!remove_mode && !prio)
 		usage();
 	if (prio) {
 		p = strchr(prio, ':');
@@ -177,12 +189,37 @@ handle_args(int argc, char *argv[], char *prio)
 /**
  * Fill a filter
  * 
- * @param  filter    The filter to fill
- * @param  is_start  If the fitler is a linearisation filter
+ * @param   index  The index of the filter in `crtc_updates`
+ * @param   data   Not used
+ * @return         Zero
  */
-static void
-fill_filter(libcoopgamma_filter_t *restrict filter, int is_start)
+static int
+fill_filter(size_t index, void *data)
 {
+	libcoopgamma_filter_t *restrict filter = &crtc_updates[index].filter;
+	int is_start = strchr(filter->class, '\0')[-1] == 't';
+	struct kernel kernels[3] = {{.reverse = 0}, {.reverse = 0}, {.reverse = 0}};
+	enum kernel_op op = is_start ? KERNEL_LINEARISE : KERNEL_STANDARDISE;
+	enum baked_curve curve = is_start ? BAKED_LINEARISE : BAKED_STANDARDISE;
+	enum baked_curve curves[3];
+
+	curves[0] = rplus ? BAKED_KEEP : curve;
+	curves[1] = gplus ? BAKED_KEEP : curve;
+	curves[2] = bplus ? BAKED_KEEP : curve;
+	if (kernel_fill_baked(filter, curves))
+		return 0;
+
+	if (kernel_approximate) {
+		if (!rplus)
+			kernel_push(&kernels[0], op, 0, 0);
+		if (!gplus)
+			kernel_push(&kernels[1], op, 0, 0);
+		if (!bplus)
+			kernel_push(&kernels[2], op, 0, 0);
+		kernel_fill(filter, kernels);
+		return 0;
+	}
+
 	switch (filter->depth) {
 #define X(CONST, MEMBER, MAX, TYPE)\
 		case CONST:\
@@ -196,6 +233,40 @@ fill_filter(libcoopgamma_filter_t *restrict filter, int is_start)
 	default:
 		abort();
 	}
+	return 0;
+	(void) data;
+}
+
+
+/**
+ * Apply new parameters received in resident mode
+ * 
+ * @param   argc  The number of received arguments
+ * @param   argv  `NULL` terminated list of received arguments
+ * @return        0: Success
+ *                1: Invalid arguments
+ *                -1: Error, `errno` set
+ */
+static int
+update_params(int argc, char *argv[])
+{
+	int r = 0, g = 0, b = 0, *flag;
+	char *p;
+	for (; *argv; argv++) {
+		if (**argv != '+' || !(*argv)[1])
+			return 1;
+		for (p = &(*argv)[1]; *p; p++) {
+			flag = *p == 'r' ? &r : *p == 'g' ? &g : *p == 'b' ? &b : NULL;
+			if (!flag || *flag)
+				return 1;
+			*flag = 1;
+		}
+	}
+	rplus = r;
+	gplus = g;
+	bplus = b;
+	return fill_cached_filters(&fill_filter, NULL, FILL_IDENTITY | (r == g && g == b ? FILL_SAME_CHANNELS : 0),
+	                           (int []){r, g, b, kernel_approximate}, sizeof(int [4]));
 }
 
 
@@ -210,55 +281,32 @@ fill_filter(libcoopgamma_filter_t *restrict filter, int is_start)
 int
 start(void)
 {
-	int r, is_start;
-	size_t i, j;
+	int r, is_start, same;
+	size_t i;
 
-	if (xflag)
-		for (i = 0; i < filters_n; i++)
-			crtc_updates[i].filter.lifespan = LIBCOOPGAMMA_REMOVE;
-	else if (dflag)
+	if (dflag)
 		for (i = 0; i < filters_n; i++)
 			crtc_updates[i].filter.lifespan = LIBCOOPGAMMA_UNTIL_DEATH;
 	else
 		for (i = 0; i < filters_n; i++)
 			crtc_updates[i].filter.lifespan = LIBCOOPGAMMA_UNTIL_REMOVAL;
 
-	for (i = 0, r = 1; i < filters_n; i++) {
-		if (!crtc_info[crtc_updates[i].crtc].supported)
-			continue;
-		if (!xflag) {
-			is_start = strchr(crtc_updates[i].filter.class, '\0')[-1] == 't';
-			fill_filter(&crtc_updates[i].filter, is_start);
-			crtc_updates[i].filter.priority = is_start ? start_priority : stop_priority;
-		}
-		r = update_filter(i, 0);
-		if (r == -2 || (r == -1 && errno != EAGAIN))
-			return r;
+	for (i = 0; i < filters_n; i++) {
+		is_start = strchr(crtc_updates[i].filter.class, '\0')[-1] == 't';
+		crtc_updates[i].filter.priority = is_start ? start_priority : stop_priority;
 	}
 
-	while (r != 1)
-		if ((r = synchronise(-1)) < 0)
+	same = rplus == gplus && gplus == bplus ? FILL_SAME_CHANNELS : 0;
+	if ((r = fill_cached_filters(&fill_filter, NULL, FILL_UPDATE | FILL_IDENTITY | same,
+	                             (int []){rplus, gplus, bplus, kernel_approximate}, sizeof(int [4]))) < 0)
+		return r;
+
+	while ((r = synchronise(-1)) != 1)
+		if (r < 0)
 			return r;
 
 	if (!dflag)
 		return 0;
 
-	if (libcoopgamma_set_nonblocking(&cg, 0) < 0)
-		return -1;
-	for (;;) {
-		if (libcoopgamma_synchronise(&cg, NULL, 0, &j) < 0) {
-			switch (errno) {
-			case 0:
-				break;
-			case ENOTRECOVERABLE:
-				goto enotrecoverable;
-			default:
-				return -1;
-			}
-		}
-	}
-
-enotrecoverable:
-	pause();
-	return -1;
+	return stay_alive();
 }
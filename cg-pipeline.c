@@ -0,0 +1,271 @@
+/* See LICENSE file for copyright and license details. */
+#include "cg-pipeline.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+
+/**
+ * Initialise a pipeline
+ * 
+ * @param   pipeline  The pipeline to initialise
+ * @param   ctx       The libcoopgamma context, must be in nonblocking mode
+ * @param   window    The maximum number of requests waiting for response
+ * @return            Zero on success, -1 on error
+ */
+int
+pipeline_initialise(pipeline_t *restrict pipeline, libcoopgamma_context_t *restrict ctx, size_t window)
+{
+	size_t i;
+
+	memset(pipeline, 0, sizeof(*pipeline));
+	pipeline->ctx = ctx;
+	pipeline->window = window ? window : 1;
+
+	pipeline->asyncs = calloc(pipeline->window, sizeof(*pipeline->asyncs));
+	if (!pipeline->asyncs)
+		goto fail;
+	pipeline->inflight = calloc(pipeline->window, sizeof(*pipeline->inflight));
+	if (!pipeline->inflight)
+		goto fail;
+	for (i = 0; i < pipeline->window; i++)
+		if (libcoopgamma_async_context_initialise(pipeline->asyncs + i) < 0)
+			goto fail;
+
+	return 0;
+fail:
+	pipeline_destroy(pipeline);
+	return -1;
+}
+
+
+/**
+ * Release all resources allocated to a pipeline
+ * 
+ * @param  pipeline  The pipeline
+ */
+void
+pipeline_destroy(pipeline_t *pipeline)
+{
+	size_t i;
+
+	if (pipeline->asyncs)
+		for (i = 0; i < pipeline->window; i++)
+			libcoopgamma_async_context_destroy(pipeline->asyncs + i);
+	free(pipeline->asyncs);
+	free(pipeline->inflight);
+	free(pipeline->queue);
+	pipeline->asyncs = NULL;
+	pipeline->inflight = NULL;
+	pipeline->queue = NULL;
+	pipeline->inflight_n = pipeline->queue_n = pipeline->queue_size = 0;
+}
+
+
+/**
+ * Submit a request, it will be sent by `pipeline_run`
+ * 
+ * @param   pipeline  The pipeline
+ * @param   kind      The kind of request
+ * @param   index     Index passed to the callbacks in `kind`
+ * @return            Zero on success, -1 on error
+ */
+int
+pipeline_submit(pipeline_t *restrict pipeline, const pipeline_kind_t *restrict kind, size_t index)
+{
+	struct pipeline_request *new;
+	size_t new_size, pos;
+
+	if (pipeline->queue_n == pipeline->queue_size) {
+		new_size = pipeline->queue_size ? (pipeline->queue_size << 1) : 8;
+		if (new_size > SIZE_MAX / sizeof(*new)) {
+			errno = ENOMEM;
+			return -1;
+		}
+		new = realloc(pipeline->queue, new_size * sizeof(*new));
+		if (!new)
+			return -1;
+		memcpy(new + pipeline->queue_size, new, pipeline->queue_head * sizeof(*new));
+		pipeline->queue = new;
+		pipeline->queue_size = new_size;
+	}
+
+	pos = (pipeline->queue_head + pipeline->queue_n++) % pipeline->queue_size;
+	pipeline->queue[pos].kind = kind;
+	pipeline->queue[pos].index = index;
+	return 0;
+}
+
+
+/**
+ * Send submitted requests until the window is full
+ * 
+ * @param   pipeline  The pipeline
+ * @return            Zero on success, -1 on error
+ */
+int
+pipeline_dispatch(pipeline_t *pipeline)
+{
+	struct pipeline_request *request;
+
+	while (pipeline->queue_n && pipeline->inflight_n < pipeline->window) {
+		request = pipeline->queue + pipeline->queue_head;
+		if (request->kind->send(pipeline->ctx, request->index, pipeline->asyncs + pipeline->inflight_n) < 0) {
+			switch (errno) {
+			case EINTR:
+			case EAGAIN:
+#if EAGAIN != EWOULDBLOCK
+			case EWOULDBLOCK:
+#endif
+				pipeline->flush_pending = 1;
+				break;
+			default:
+				return -1;
+			}
+		}
+		pipeline->inflight[pipeline->inflight_n++] = *request;
+		pipeline->queue_head = (pipeline->queue_head + 1) % pipeline->queue_size;
+		pipeline->queue_n -= 1;
+	}
+
+	return 0;
+}
+
+
+/**
+ * Flush and receive responses after the connection
+ * to the server has become ready
+ * 
+ * Messages that are not responses to any pending
+ * request are discarded, so this function shall
+ * be called whenever the connection is readable,
+ * even if no request is pending
+ * 
+ * @param   pipeline  The pipeline
+ * @param   revents   The events, as reported by `poll`,
+ *                    that occurred on the connection
+ * @return            Zero on success, -1 on error, -2
+ *                    on libcoopgamma error
+ * 
+ * @throws  ENOTRECOVERABLE  The connection was closed by the server
+ */
+int
+pipeline_handle(pipeline_t *pipeline, int revents)
+{
+	struct pipeline_request request;
+	libcoopgamma_async_context_t async;
+	size_t selected;
+	int r;
+
+	if (pipeline->flush_pending && (revents & (POLLOUT | POLLERR | POLLHUP | POLLNVAL))) {
+		if (libcoopgamma_flush(pipeline->ctx) < 0) {
+			switch (errno) {
+			case EINTR:
+			case EAGAIN:
+#if EAGAIN != EWOULDBLOCK
+			case EWOULDBLOCK:
+#endif
+				break;
+			default:
+				return -1;
+			}
+		} else {
+			pipeline->flush_pending = 0;
+		}
+	}
+
+	if (!(revents & (POLLIN | POLLRDNORM | POLLRDBAND | POLLPRI | POLLERR | POLLHUP | POLLNVAL)))
+		return 0;
+
+	for (;;) {
+		if (libcoopgamma_synchronise(pipeline->ctx, pipeline->asyncs, pipeline->inflight_n, &selected) < 0) {
+			switch (errno) {
+			case 0:
+				continue;
+			case EINTR:
+			case EAGAIN:
+#if EAGAIN != EWOULDBLOCK
+			case EWOULDBLOCK:
+#endif
+				return 0;
+			default:
+				return -1;
+			}
+		}
+		request = pipeline->inflight[selected];
+		async = pipeline->asyncs[selected];
+		pipeline->inflight_n -= 1;
+		pipeline->inflight[selected] = pipeline->inflight[pipeline->inflight_n];
+		pipeline->asyncs[selected] = pipeline->asyncs[pipeline->inflight_n];
+		if ((r = request.kind->recv(pipeline->ctx, request.index, &async)) < 0)
+			return r;
+		if (pipeline_dispatch(pipeline) < 0)
+			return -1;
+	}
+}
+
+
+/**
+ * Send as many submitted requests as the window allows,
+ * flush, and receive all available responses
+ * 
+ * @param   pipeline  The pipeline
+ * @param   timeout   The number of milliseconds the call to `poll` may block,
+ *                    -1 if it may block forever
+ * @return            1: Success, no pending requests
+ *                    0: Success, with still pending requests
+ *                    -1: Error, `errno` set
+ *                    -2: Error, `pipeline->ctx->error` set
+ * 
+ * @throws  EINTR   Call to `poll` was interrupted by a signal
+ * @throws  EAGAIN  Call to `poll` timed out
+ */
+int
+pipeline_run(pipeline_t *pipeline, int timeout)
+{
+	struct pollfd pollfd;
+	int r;
+
+	if (pipeline_dispatch(pipeline) < 0)
+		return -1;
+	if (!pipeline->inflight_n)
+		return 1;
+
+	pollfd.fd = pipeline->ctx->fd;
+	pollfd.events = POLLIN | POLLRDNORM | POLLRDBAND | POLLPRI;
+	if (pipeline->flush_pending)
+		pollfd.events |= POLLOUT;
+
+	pollfd.revents = 0;
+	if (poll(&pollfd, (nfds_t)1, timeout) < 0)
+		return -1;
+
+	if ((r = pipeline_handle(pipeline, pollfd.revents)) < 0)
+		return r;
+
+	return !pipeline->inflight_n;
+}
+
+
+/**
+ * Run a pipeline until all submitted requests have been completed
+ * 
+ * @param   pipeline  The pipeline
+ * @return            Zero on success, -1 on error, -2
+ *                    on libcoopgamma error
+ */
+int
+pipeline_finish(pipeline_t *pipeline)
+{
+	int r;
+
+	while ((r = pipeline_run(pipeline, -1)) != 1)
+		if (r < 0)
+			return r;
+
+	return 0;
+}
@@ -0,0 +1,205 @@
+/* See LICENSE file for copyright and license details. */
+#include <libcoopgamma.h>
+
+#include <stddef.h>
+
+
+
+/**
+ * The default maximum number of requests
+ * that may be waiting for a response
+ */
+#define PIPELINE_WINDOW 64
+
+
+
+/**
+ * A kind of asynchronous request
+ */
+typedef struct pipeline_kind
+{
+	/**
+	 * Send a request
+	 * 
+	 * @param   ctx    The libcoopgamma context
+	 * @param   index  The index the request was submitted with
+	 * @param   async  Output parameter for the asynchronous call context
+	 * @return         Zero on success, -1 on error; if the request was
+	 *                 sent but could not be flushed, `errno` shall be
+	 *                 set to EINTR, EAGAIN, or EWOULDBLOCK
+	 */
+	int (*send)(libcoopgamma_context_t *ctx, size_t index, libcoopgamma_async_context_t *async);
+
+	/**
+	 * Receive the response for a request
+	 * 
+	 * @param   ctx    The libcoopgamma context
+	 * @param   index  The index the request was submitted with
+	 * @param   async  The asynchronous call context
+	 * @return         Zero on success, -1 on error, -2
+	 *                 on libcoopgamma error
+	 */
+	int (*recv)(libcoopgamma_context_t *ctx, size_t index, libcoopgamma_async_context_t *async);
+
+} pipeline_kind_t;
+
+
+/**
+ * A submitted request
+ */
+struct pipeline_request
+{
+	/**
+	 * The kind of request
+	 */
+	const pipeline_kind_t *kind;
+
+	/**
+	 * The index the request was submitted with
+	 */
+	size_t index;
+};
+
+
+/**
+ * Queue of asynchronous requests with a bounded
+ * number of requests waiting for response
+ */
+typedef struct pipeline
+{
+	/**
+	 * The libcoopgamma context, must be in nonblocking mode
+	 */
+	libcoopgamma_context_t *ctx;
+
+	/**
+	 * The maximum number of requests waiting for response
+	 */
+	size_t window;
+
+	/**
+	 * The number of requests waiting for response
+	 */
+	size_t inflight_n;
+
+	/**
+	 * Asynchronous call contexts for the requests
+	 * waiting for response, only the first
+	 * `.inflight_n` are in use
+	 */
+	libcoopgamma_async_context_t *asyncs;
+
+	/**
+	 * The requests waiting for response,
+	 * in the same order as `.asyncs`
+	 */
+	struct pipeline_request *inflight;
+
+	/**
+	 * Circular buffer of requests that have not been sent
+	 */
+	struct pipeline_request *queue;
+
+	/**
+	 * The position of the first element in `.queue`
+	 */
+	size_t queue_head;
+
+	/**
+	 * The number of elements in `.queue`
+	 */
+	size_t queue_n;
+
+	/**
+	 * The allocation size of `.queue`
+	 */
+	size_t queue_size;
+
+	/**
+	 * Whether sent messages must be flushed
+	 */
+	int flush_pending;
+
+} pipeline_t;
+
+
+
+/**
+ * Initialise a pipeline
+ * 
+ * @param   pipeline  The pipeline to initialise
+ * @param   ctx       The libcoopgamma context, must be in nonblocking mode
+ * @param   window    The maximum number of requests waiting for response
+ * @return            Zero on success, -1 on error
+ */
+int pipeline_initialise(pipeline_t *restrict pipeline, libcoopgamma_context_t *restrict ctx, size_t window);
+
+/**
+ * Release all resources allocated to a pipeline
+ * 
+ * @param  pipeline  The pipeline
+ */
+void pipeline_destroy(pipeline_t *pipeline);
+
+/**
+ * Submit a request, it will be sent by `pipeline_run`
+ * 
+ * @param   pipeline  The pipeline
+ * @param   kind      The kind of request
+ * @param   index     Index passed to the callbacks in `kind`
+ * @return            Zero on success, -1 on error
+ */
+int pipeline_submit(pipeline_t *restrict pipeline, const pipeline_kind_t *restrict kind, size_t index);
+
+/**
+ * Send submitted requests until the window is full
+ * 
+ * @param   pipeline  The pipeline
+ * @return            Zero on success, -1 on error
+ */
+int pipeline_dispatch(pipeline_t *pipeline);
+
+/**
+ * Flush and receive responses after the connection
+ * to the server has become ready
+ * 
+ * Messages that are not responses to any pending
+ * request are discarded, so this function shall
+ * be called whenever the connection is readable,
+ * even if no request is pending
+ * 
+ * @param   pipeline  The pipeline
+ * @param   revents   The events, as reported by `poll`,
+ *                    that occurred on the connection
+ * @return            Zero on success, -1 on error, -2
+ *                    on libcoopgamma error
+ * 
+ * @throws  ENOTRECOVERABLE  The connection was closed by the server
+ */
+int pipeline_handle(pipeline_t *pipeline, int revents);
+
+/**
+ * Send as many submitted requests as the window allows,
+ * flush, and receive all available responses
+ * 
+ * @param   pipeline  The pipeline
+ * @param   timeout   The number of milliseconds the call to `poll` may block,
+ *                    -1 if it may block forever
+ * @return            1: Success, no pending requests
+ *                    0: Success, with still pending requests
+ *                    -1: Error, `errno` set
+ *                    -2: Error, `pipeline->ctx->error` set
+ * 
+ * @throws  EINTR   Call to `poll` was interrupted by a signal
+ * @throws  EAGAIN  Call to `poll` timed out
+ */
+int pipeline_run(pipeline_t *pipeline, int timeout);
+
+/**
+ * Run a pipeline until all submitted requests have been completed
+ * 
+ * @param   pipeline  The pipeline
+ * @return            Zero on success, -1 on error, -2
+ *                    on libcoopgamma error
+ */
+int pipeline_finish(pipeline_t *pipeline);
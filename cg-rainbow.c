@@ -5,11 +5,9 @@
 
 #include <errno.h>
 #include <math.h>
-#include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <time.h>
 #include <unistd.h>
 
 
@@ -29,6 +27,11 @@ char default_class[] = PKGNAME "::cg-rainbow::standard";
  */
 const char *const *class_suffixes = (const char *const[]){NULL};
 
+/**
+ * Resident mode is not supported
+ */
+int (*const handle_update)(int argc, char *argv[]) = NULL;
+
 
 
 /**
@@ -41,6 +44,11 @@ static char *sflag = NULL;
  */
 static char *lflag = NULL;
 
+/**
+ * -f: frame rate
+ */
+static char *fflag = NULL;
+
 /**
  * The rainbow-frequency multiplied by 3
  */
@@ -60,8 +68,8 @@ void
 usage(void)
 {
 	fprintf(stderr,
-	       "usage: %s [-M method] [-S site] [-c crtc]... [-R rule] [-p priority]"
-	       " [-l luminosity] [-s rainbowhz]\n",
+	       "usage: %s [-M method] [-S site] [-c crtc]... [-R rule] [-v] [-p priority]"
+	       " [-l luminosity] [-s rainbowhz] [-f framerate]\n",
 	       argv0);
 	exit(1);
 }
@@ -73,7 +81,7 @@ usage(void)
  * @param   opt  The option, it is a NUL-terminate two-character
  *               string starting with either '-' or '+', if the
  *               argument is not recognised, call `usage`. This
- *               string will not be "-M", "-S", "-c", "-p", or "-R".
+ *               string will not be "-M", "-S", "-c", "-p", "-R", "-D", or "-v".
  * @param   arg  The argument associated with `opt`,
  *               `NULL` there is no next argument, if this
  *               parameter is `NULL` but needed, call `usage`
@@ -94,6 +102,10 @@ handle_opt(char *opt, char *arg)
 			if (sflag || !(sflag = arg))
 				usage();
 			return 1;
+		case 'f':
+			if (fflag || !(fflag = arg))
+				usage();
+			return 1;
 		default:
 			usage();
 		}
@@ -137,7 +149,7 @@ parse_double(double *restrict out, const char *restrict str)
 int
 handle_args(int argc, char *argv[], char *prio)
 {
-	int q = (lflag || sflag);
+	int q = (lflag || sflag || fflag);
 	if (q > 1 || argc)
 		usage();
 	if (sflag) {
@@ -149,6 +161,10 @@ handle_args(int argc, char *argv[], char *prio)
 		if (parse_double(&luminosity, lflag) < 0)
 			usage();
 	}
+	if (fflag) {
+		if (parse_double(&frame_rate, fflag) < 0 || !frame_rate)
+			usage();
+	}
 	return 0;
 	(void) argv;
 	(void) prio;
@@ -158,47 +174,58 @@ handle_args(int argc, char *argv[], char *prio)
 /**
  * Fill a filter
  * 
- * @param  filter  The filter to fill
- * @param  red     The red brightness
- * @param  green   The green brightness
- * @param  blue    The blue brightness
+ * @param   index  The index of the filter in `crtc_updates`
+ * @param   data   The red, green, and blue brightness, `double[3]`
+ * @return         Zero
  */
-static void
-fill_filter(libcoopgamma_filter_t *restrict filter, double red, double green, double blue)
+static int
+fill_filter(size_t index, void *data)
 {
+	libcoopgamma_filter_t *restrict filter = &crtc_updates[index].filter;
+	const double *rgb = data;
 	switch (filter->depth) {
 #define X(CONST, MEMBER, MAX, TYPE)\
 	case CONST:\
 		libclut_start_over(&filter->ramps.MEMBER, MAX, TYPE, 1, 1, 1);\
-		libclut_rgb_brightness(&filter->ramps.MEMBER, MAX, TYPE, red, green, blue);\
+		libclut_rgb_brightness(&filter->ramps.MEMBER, MAX, TYPE, rgb[0], rgb[1], rgb[2]);\
 		break;
 	LIST_DEPTHS
 #undef X
 	default:
 		abort();
 	}
+	return 0;
 }
 
 
 /**
- * Get the current monotonic time as a double
+ * Render a frame of the rainbow
  * 
- * @param   now  Output parameter for the current time (monotonic)
- * @return       Zero on success, -1 on error
+ * @param   t     The number of seconds since the first frame
+ * @param   data  Not used
+ * @return        0: Success, the rainbow never ends
+ *                -1: Error, `errno` set
+ *                -2: Error, `cg.error` set
  */
 static int
-double_time(double *restrict now)
+render_frame(double t, void *data)
 {
-#ifndef CLOCK_MONOTONIC_RAW
-# define CLOCK_MONOTONIC_RAW  CLOCK_MONOTONIC
-#endif
-	struct timespec ts;
-	if (clock_gettime(CLOCK_MONOTONIC_RAW, &ts) < 0)
-		return -1;
-	*now  = (double)(ts.tv_nsec);
-	*now /= 1000000000L;
-	*now += (double)(ts.tv_sec);
-	return 0;
+	double pal[3];
+
+	(void) data;
+
+	t *= rainbows_per_third_second;
+	pal[0] = pal[1] = pal[2] = luminosity;
+	pal[((long)t) % 3] += 1 - fmod(t, 1);
+	pal[((long)t + 1) % 3] += fmod(t, 1);
+	if (pal[0] > 1)
+		pal[0] = 1;
+	if (pal[1] > 1)
+		pal[1] = 1;
+	if (pal[2] > 1)
+		pal[2] = 1;
+
+	return fill_filters(&fill_filter, pal, FILL_REFRESH);
 }
 
 
@@ -214,9 +241,7 @@ int
 start(void)
 {
 	int r;
-	size_t i, j;
-	double pal[3];
-	double t, starttime;
+	size_t i;
 
 	for (i = 0; i < filters_n; i++)
 		crtc_updates[i].filter.lifespan = LIBCOOPGAMMA_UNTIL_DEATH;
@@ -224,44 +249,5 @@ start(void)
 	if ((r = make_slaves()) < 0)
 		return r;
 
-	if ((r = double_time(&starttime)) < 0)
-		return r;
-
-	for (;;) {
-		if ((r = double_time(&t)) < 0)
-			return r;
-		t -= starttime;
-		t *= rainbows_per_third_second;
-		pal[0] = pal[1] = pal[2] = luminosity;
-		pal[((long)t) % 3] += 1 - fmod(t, 1);
-		pal[((long)t + 1) % 3] += fmod(t, 1);
-		if (pal[0] > 1)
-			pal[0] = 1;
-		if (pal[1] > 1)
-			pal[1] = 1;
-		if (pal[2] > 1)
-			pal[2] = 1;
-
-		for (i = 0, r = 1; i < filters_n; i++) {
-			if (!crtc_updates[i].master || !crtc_info[crtc_updates[i].crtc].supported)
-				continue;
-			fill_filter(&crtc_updates[i].filter, pal[0], pal[1], pal[2]);
-			r = update_filter(i, 0);
-			if (r == -2 || (r == -1 && errno != EAGAIN))
-				return r;
-			if (crtc_updates[i].slaves) {
-				for (j = 0; crtc_updates[i].slaves[j]; j++) {
-					r = update_filter(crtc_updates[i].slaves[j], 0);
-					if (r == -2 || (r == -1 && errno != EAGAIN))
-						return r;
-				}
-			}
-		}
-
-		while (r != 1)
-			if ((r = synchronise(-1)) < 0)
-				return r;
-
-		sched_yield();
-	}
+	return animate(&render_frame, NULL);
 }
@@ -1,11 +1,11 @@
 /* See LICENSE file for copyright and license details. */
 #include "arg.h"
+#include "cg-pipeline.h"
 
 #include <libcoopgamma.h>
 
 #include <errno.h>
 #include <inttypes.h>
-#include <poll.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -18,6 +18,21 @@
  */
 static libcoopgamma_context_t cg;
 
+/**
+ * The names of the selected CRTC:s
+ */
+static char *const *remove_crtcs;
+
+/**
+ * The filter classes to remove
+ */
+static char *const *remove_classes;
+
+/**
+ * The number of elements in `remove_classes`
+ */
+static size_t classes_n;
+
 
 
 /**
@@ -112,6 +127,51 @@ list_crtcs(void)
 }
 
 
+/**
+ * Send a filter removal request
+ * 
+ * @param   ctx    The libcoopgamma context
+ * @param   index  The index of the CRTC times `classes_n`
+ *                 plus the index of the class
+ * @param   async  Output parameter for the asynchronous call context
+ * @return         Zero on success, -1 on error
+ */
+static int
+send_removal(libcoopgamma_context_t *ctx, size_t index, libcoopgamma_async_context_t *async)
+{
+	libcoopgamma_filter_t command;
+
+	memset(&command, 0, sizeof(command));
+	command.lifespan = LIBCOOPGAMMA_REMOVE;
+	command.crtc = remove_crtcs[index / classes_n];
+	command.class = remove_classes[index % classes_n];
+	return libcoopgamma_set_gamma_send(&command, ctx, async);
+}
+
+
+/**
+ * Receive the response for a filter removal request
+ * 
+ * @param   ctx    The libcoopgamma context
+ * @param   index  The index of the CRTC times `classes_n`
+ *                 plus the index of the class
+ * @param   async  The asynchronous call context
+ * @return         Zero on success, -2 on libcoopgamma error
+ */
+static int
+recv_removal(libcoopgamma_context_t *ctx, size_t index, libcoopgamma_async_context_t *async)
+{
+	(void) index;
+	return libcoopgamma_set_gamma_recv(ctx, async) < 0 ? -2 : 0;
+}
+
+
+/**
+ * Filter removal requests
+ */
+static const pipeline_kind_t removal_request = {&send_removal, &recv_removal};
+
+
 /**
  * Remove selected filters from selected CRTC:s
  * 
@@ -123,116 +183,33 @@ list_crtcs(void)
 static int
 remove_filters(char *const *restrict crtcs, char *const *restrict classes)
 {
-	size_t n = 0, unsynced = 0, selected, i, j;
-	char *synced = NULL;
-	libcoopgamma_async_context_t *asyncs = NULL;
-	int saved_errno, need_flush = 0, ret = 0;
-	struct pollfd pollfd;
-	libcoopgamma_filter_t command;
+	pipeline_t pipeline;
+	size_t i, n;
+	int saved_errno, ret;
 
+	remove_crtcs = crtcs;
+	remove_classes = classes;
 	for (i = 0; crtcs[i]; i++);
-	for (j = 0; classes[j]; j++);
-	synced = calloc(i, j * sizeof(*synced));
-	if (!synced)
-		goto fail;
-	asyncs = calloc(i, j * sizeof(*asyncs));
-	if (!asyncs)
-		goto fail;
-
-	i = j = 0;
-	command.lifespan = LIBCOOPGAMMA_REMOVE;
-	pollfd.fd = cg.fd;
-	pollfd.events = POLLIN | POLLRDNORM | POLLRDBAND | POLLPRI;
-
-	while (unsynced > 0 || crtcs[i]) {
-	wait:
-		if (crtcs[i])
-			pollfd.events |= POLLOUT;
-		else
-			pollfd.events &= ~POLLOUT;
-
-		pollfd.revents = 0;
-		if (poll(&pollfd, (nfds_t)1, -1) < 0)
-			goto fail;
+	for (classes_n = 0; classes[classes_n]; classes_n++);
+	n = i * classes_n;
 
-		if (pollfd.revents & (POLLOUT | POLLERR | POLLHUP | POLLNVAL)) {
-			if (need_flush && (libcoopgamma_flush(&cg) < 0))
-				goto send_fail;
-			need_flush = 0;
-			for (; crtcs[i]; i++, j = 0) {
-				command.crtc = crtcs[i];
-				while (classes[j]) {
-					command.class = classes[j++];
-					unsynced++;
-					if (libcoopgamma_set_gamma_send(&command, &cg, asyncs + n++) < 0)
-						goto send_fail;
-				}
-			}
-			goto send_done;
-		send_fail:
-			switch (errno) {
-			case EINTR:
-			case EAGAIN:
-#if EAGAIN != EWOULDBLOCK
-			case EWOULDBLOCK:
-#endif
-				need_flush = 1;
-				if (!classes[j])
-					i++, j = 0;
-				break;
-			default:
-				goto fail;
-			}
-		}
-	send_done:
+	if (pipeline_initialise(&pipeline, &cg, PIPELINE_WINDOW) < 0)
+		return -1;
 
-		if (!unsynced && !crtcs[i])
-			break;
+	for (i = 0; i < n; i++)
+		if (pipeline_submit(&pipeline, &removal_request, i) < 0)
+			goto fail;
 
-		if (pollfd.revents & (POLLIN | POLLRDNORM | POLLRDBAND | POLLPRI)) {
-			while (unsynced > 0) {
-				switch (libcoopgamma_synchronise(&cg, asyncs, n, &selected)) {
-				case 0:
-					if (synced[selected]) {
-						libcoopgamma_skip_message(&cg);
-						break;
-					}
-					synced[selected] = 1;
-					unsynced -= 1;
-					if (libcoopgamma_set_gamma_recv(&cg, asyncs + selected) < 0)
-						goto cg_fail;
-					break;
-				default:
-					switch (errno) {
-					case 0:
-						break;
-					case EINTR:
-					case EAGAIN:
-#if EAGAIN != EWOULDBLOCK
-					case EWOULDBLOCK:
-#endif
-						goto wait;
-					default:
-						goto fail;
-					}
-					break;
-				}
-			}
-		}
-	}
+	ret = pipeline_finish(&pipeline);
 
 done:
 	saved_errno = errno;
-	free(synced);
-	free(asyncs);
+	pipeline_destroy(&pipeline);
 	errno = saved_errno;
 	return ret;
 fail:
 	ret = -1;
 	goto done;
-cg_fail:
-	ret = -2;
-	goto done;
 }
 
 
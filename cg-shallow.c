@@ -1,5 +1,6 @@
 /* See LICENSE file for copyright and license details. */
 #include "cg-base.h"
+#include "cg-kernel.h"
 
 #include <libclut.h>
 
@@ -27,6 +28,12 @@ char default_class[] = PKGNAME "::cg-shallow::standard";
  */
 const char *const *class_suffixes = (const char *const[]){NULL};
 
+/**
+ * Handler for parameter updates in resident mode
+ */
+static int update_params(int argc, char *argv[]);
+int (*const handle_update)(int argc, char *argv[]) = &update_params;
+
 
 
 /**
@@ -34,11 +41,6 @@ const char *const *class_suffixes = (const char *const[]){NULL};
  */
 static int dflag = 0;
 
-/**
- * -x: remove filter rather than adding it
- */
-static int xflag = 0;
-
 /**
  * The emulated red resolution, 0 for unchanged.
  */
@@ -62,8 +64,8 @@ void
 usage(void)
 {
 	fprintf(stderr,
-	        "usage: %s [-M method] [-S site] [-c crtc]... [-R rule] "
-	        "(-x | [-p priority] [-d] [all | red green blue])\n",
+	        "usage: %s [-M method] [-S site] [-c crtc]... [-R rule] [-v] "
+	        "(-x | [-p priority] [-d] [-D fifo] [all | red green blue])\n",
 	        argv0);
 	exit(1);
 }
@@ -75,7 +77,7 @@ usage(void)
  * @param   opt  The option, it is a NUL-terminate two-character
  *               string starting with either '-' or '+', if the
  *               argument is not recognised, call `usage`. This
- *               string will not be "-M", "-S", "-c", "-p", or "-R".
+ *               string will not be "-M", "-S", "-c", "-p", "-R", "-D", or "-v".
  * @param   arg  The argument associated with `opt`,
  *               `NULL` there is no next argument, if this
  *               parameter is `NULL` but needed, call `usage`
@@ -89,14 +91,14 @@ handle_opt(char *opt, char *arg)
 	if (opt[0] == '-') {
 		switch (opt[1]) {
 		case 'd':
-			if (dflag || xflag)
+			if (dflag || remove_mode)
 				usage();
 			dflag = 1;
 			break;
 		case 'x':
-			if (xflag || dflag)
+			if (remove_mode || dflag)
 				usage();
-			xflag = 1;
+			remove_mode = 1;
 			break;
 		default:
 			usage();
@@ -145,8 +147,8 @@ handle_args(int argc, char *argv[], char *prio)
 	char *red = NULL;
 	char *green = NULL;
 	char *blue = NULL;
-	int q = xflag + (dflag | (argc > 0));
-	if (q > 1 || (xflag && prio))
+	int q = remove_mode + (dflag | (argc > 0));
+	if (q > 1 || (remove_mode && prio))
 		usage();
 	if (argc == 1) {
 		red = green = blue = argv[0];
@@ -154,15 +156,15 @@ handle_args(int argc, char *argv[], char *prio)
 		red   = argv[0];
 		green = argv[1];
 		blue  = argv[2];
-	} else if (argc && !xflag) {
+	} else if (argc && !remove_mode) {
 		usage();
 	}
 	if (argc) {
 		if (parse_int(&rres, red) < 0)
 			usage();
-		if (parse_int(&gres, blue) < 0)
+		if (parse_int(&gres, green) < 0)
 			usage();
-		if (parse_int(&bres, green) < 0)
+		if (parse_int(&bres, blue) < 0)
 			usage();
 	}
 	return 0;
@@ -173,11 +175,19 @@ handle_args(int argc, char *argv[], char *prio)
 /**
  * Fill a filter
  * 
- * @param  filter  The filter to fill
+ * @param   index  The index of the filter in `crtc_updates`
+ * @param   data   Not used
+ * @return         Zero
  */
-static void
-fill_filter(libcoopgamma_filter_t *restrict filter)
+static int
+fill_filter(size_t index, void *data)
 {
+	libcoopgamma_filter_t *restrict filter = &crtc_updates[index].filter;
+
+	if (rres == BAKED_SHALLOW_RESOLUTION && gres == rres && bres == rres &&
+	    kernel_fill_baked(filter, (const enum baked_curve[]){BAKED_SHALLOW, BAKED_SHALLOW, BAKED_SHALLOW}))
+		return 0;
+
 	switch (filter->depth) {
 #define X(CONST, MEMBER, MAX, TYPE)\
 	case CONST:\
@@ -188,6 +198,40 @@ fill_filter(libcoopgamma_filter_t *restrict filter)
 	default:
 		abort();
 	}
+	return 0;
+	(void) data;
+}
+
+
+/**
+ * Apply new parameters received in resident mode
+ * 
+ * @param   argc  The number of received arguments
+ * @param   argv  `NULL` terminated list of received arguments
+ * @return        0: Success
+ *                1: Invalid arguments
+ *                -1: Error, `errno` set
+ */
+static int
+update_params(int argc, char *argv[])
+{
+	size_t r, g, b;
+	if (argc == 1) {
+		if (parse_int(&r, argv[0]) < 0)
+			return 1;
+		g = b = r;
+	} else if (argc == 3) {
+		if (parse_int(&r, argv[0]) < 0 ||
+		    parse_int(&g, argv[1]) < 0 ||
+		    parse_int(&b, argv[2]) < 0)
+			return 1;
+	} else {
+		return 1;
+	}
+	rres = r;
+	gres = g;
+	bres = b;
+	return fill_filters(&fill_filter, NULL, FILL_IDENTITY | (r == g && g == b ? FILL_SAME_CHANNELS : 0));
 }
 
 
@@ -202,62 +246,29 @@ fill_filter(libcoopgamma_filter_t *restrict filter)
 int
 start(void)
 {
-	int r;
-	size_t i, j;
+	int r, same;
+	size_t i;
 
-	if (xflag)
-		for (i = 0; i < filters_n; i++)
-			crtc_updates[i].filter.lifespan = LIBCOOPGAMMA_REMOVE;
-	else if (dflag)
+	if (dflag)
 		for (i = 0; i < filters_n; i++)
 			crtc_updates[i].filter.lifespan = LIBCOOPGAMMA_UNTIL_DEATH;
 	else
 		for (i = 0; i < filters_n; i++)
 			crtc_updates[i].filter.lifespan = LIBCOOPGAMMA_UNTIL_REMOVAL;
 
-	if (!xflag && (r = make_slaves()) < 0)
+	if ((r = make_slaves()) < 0)
 		return r;
 
-	for (i = 0, r = 1; i < filters_n; i++) {
-		if (!crtc_updates[i].master || !crtc_info[crtc_updates[i].crtc].supported)
-			continue;
-		if (!xflag)
-			fill_filter(&crtc_updates[i].filter);
-		r = update_filter(i, 0);
-		if (r == -2 || (r == -1 && errno != EAGAIN))
-			return r;
-		if (crtc_updates[i].slaves) {
-			for (j = 0; crtc_updates[i].slaves[j]; j++) {
-				r = update_filter(crtc_updates[i].slaves[j], 0);
-				if (r == -2 || (r == -1 && errno != EAGAIN))
-					return r;
-			}
-		}
-	}
+	same = rres == gres && gres == bres ? FILL_SAME_CHANNELS : 0;
+	if ((r = fill_filters(&fill_filter, NULL, FILL_UPDATE | FILL_IDENTITY | same)) < 0)
+		return r;
 
-	while (r != 1)
-		if ((r = synchronise(-1)) < 0)
+	while ((r = synchronise(-1)) != 1)
+		if (r < 0)
 			return r;
 
 	if (!dflag)
 		return 0;
 
-	if (libcoopgamma_set_nonblocking(&cg, 0) < 0)
-		return -1;
-	for (;;) {
-		if (libcoopgamma_synchronise(&cg, NULL, 0, &j) < 0) {
-			switch (errno) {
-			case 0:
-				break;
-			case ENOTRECOVERABLE:
-				goto enotrecoverable;
-			default:
-				return -1;
-			}
-		}
-	}
-
-enotrecoverable:
-	pause();
-	return -1;
+	return stay_alive();
 }
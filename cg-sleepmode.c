@@ -1,5 +1,6 @@
 /* See LICENSE file for copyright and license details. */
 #include "cg-base.h"
+#include "cg-event.h"
 
 #include <libclut.h>
 
@@ -7,12 +8,10 @@
 # undef _GNU_SOURCE
 #endif
 #include <errno.h>
-#include <sched.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <time.h>
 #include <unistd.h>
 
 
@@ -32,6 +31,11 @@ char default_class[] = PKGNAME "::cg-sleepmode::standard";
  */
 const char *const *class_suffixes = (const char *const[]){NULL};
 
+/**
+ * Resident mode is not supported
+ */
+int (*const handle_update)(int argc, char *argv[]) = NULL;
+
 
 
 /**
@@ -49,6 +53,11 @@ static char *gflag;
  */
 static char *bflag;
 
+/**
+ * -f: frame rate
+ */
+static char *fflag;
+
 /**
  * The duration, in seconds, of the red channel's fade out
  */
@@ -79,10 +88,22 @@ static double green_target = 0;
  */
 static double blue_target = 0;
 
+/**
+ * The luminosities of the last sent frame,
+ * negative if no frame has been sent
+ */
+static double sent_red = -1, sent_green = -1, sent_blue = -1;
+
 /**
  * Time to fade in?
  */
-static volatile sig_atomic_t received_int = 0;
+static int received_int = 0;
+
+/**
+ * Event source for the signals that tells
+ * the program to terminate
+ */
+static event_source_t signal_source;
 
 
 
@@ -93,8 +114,8 @@ void
 usage(void)
 {
 	fprintf(stderr,
-	        "usage: %s [-M method] [-S site] [-c crtc]... [-R rule] [-p priority] "
-	        "[-r red-fadeout-time] [-g green-fadeout-time] [-b blue-fadeout-time] "
+	        "usage: %s [-M method] [-S site] [-c crtc]... [-R rule] [-v] [-p priority] "
+	        "[-r red-fadeout-time] [-g green-fadeout-time] [-b blue-fadeout-time] [-f framerate] "
 	        "[red-luminosity [green-luminosity [blue-luminosity]]]\n",
 	        argv0);
 	exit(1);
@@ -105,13 +126,21 @@ usage(void)
  * Called when a signal is received
  * that tells the program to terminate
  * 
- * @param  signo  The received signal
+ * @param   source   `&signal_source`
+ * @param   revents  The epoll events that occurred
+ * @return           Zero on success, -1 on error
  */
-static void
-sig_int(int signo)
+static int
+signal_received(event_source_t *source, uint32_t revents)
 {
-	received_int = 1;
-	(void) signo;
+	int signo;
+
+	(void) revents;
+	if ((signo = event_read_signals(source)) < 0)
+		return -1;
+	if (signo)
+		received_int = 1;
+	return 0;
 }
 
 
@@ -121,7 +150,7 @@ sig_int(int signo)
  * @param   opt  The option, it is a NUL-terminate two-character
  *               string starting with either '-' or '+', if the
  *               argument is not recognised, call `usage`. This
- *               string will not be "-M", "-S", "-c", "-p", or "-R".
+ *               string will not be "-M", "-S", "-c", "-p", "-R", "-D", or "-v".
  * @param   arg  The argument associated with `opt`,
  *               `NULL` there is no next argument, if this
  *               parameter is `NULL` but needed, call `usage`
@@ -146,6 +175,10 @@ handle_opt(char *opt, char *arg)
 			if (bflag || !(bflag = arg))
 				usage();
 			return 1;
+		case 'f':
+			if (fflag || !(fflag = arg))
+				usage();
+			return 1;
 		default:
 			usage();
 		}
@@ -189,7 +222,7 @@ parse_double(double *restrict out, const char *restrict str)
 int
 handle_args(int argc, char *argv[], char *prio)
 {
-	int q = (rflag || gflag || bflag || argc);
+	int q = (rflag || gflag || bflag || fflag || argc);
 	if (q > 1 || argc > 3)
 		usage();
 	if (rflag && parse_double(&red_time, rflag) < 0)
@@ -198,6 +231,8 @@ handle_args(int argc, char *argv[], char *prio)
 		usage();
 	if (bflag && parse_double(&blue_time, bflag) < 0)
 		usage();
+	if (fflag && (parse_double(&frame_rate, fflag) < 0 || !frame_rate))
+		usage();
 	if (argc >= 1 && parse_double(&red_target, argv[0]) < 0)
 		usage();
 	if (argc >= 2 && parse_double(&green_target, argv[1]) < 0)
@@ -218,47 +253,157 @@ handle_args(int argc, char *argv[], char *prio)
 /**
  * Fill a filter
  * 
- * @param  filter  The filter to fill
- * @param  red     The red brightness
- * @param  green   The green brightness
- * @param  blue    The blue brightness
+ * @param   index  The index of the filter in `crtc_updates`
+ * @param   data   The red, green, and blue brightness, `double[3]`
+ * @return         Zero
  */
-static void
-fill_filter(libcoopgamma_filter_t *restrict filter, double red, double green, double blue)
+static int
+fill_filter(size_t index, void *data)
 {
+	libcoopgamma_filter_t *restrict filter = &crtc_updates[index].filter;
+	const double *rgb = data;
 	switch (filter->depth) {
 #define X(CONST, MEMBER, MAX, TYPE)\
 	case CONST:\
 		libclut_start_over(&filter->ramps.MEMBER, MAX, TYPE, 1, 1, 1);\
-		libclut_rgb_brightness(&filter->ramps.MEMBER, MAX, TYPE, red, green, blue);\
+		libclut_rgb_brightness(&filter->ramps.MEMBER, MAX, TYPE, rgb[0], rgb[1], rgb[2]);\
 		break;
 	LIST_DEPTHS
 #undef X
 	default:
 		abort();
 	}
+	return 0;
+}
+
+
+/**
+ * Clip a luminosity to [0, 1]
+ * 
+ * @param   value  The luminosity
+ * @return         The clipped luminosity
+ */
+static double
+clip(double value)
+{
+	return value < 0 ? 0 : value > 1 ? 1 : value;
+}
+
+
+/**
+ * Calculate the luminosity of a channel while fading out
+ * 
+ * @param   t       The number of seconds since the fade out began
+ * @param   time    The duration of the channel's fade out
+ * @param   target  The luminosity of the channel after the fade out
+ * @return          The luminosity of the channel
+ */
+static double
+fade_out_value(double t, double time, double target)
+{
+	double end = clip(target), rate = (target - 1) / time, value;
+	if (t >= time || isinf(rate) || isnan(rate))
+		return end;
+	value = 1 + t * rate;
+	return value > 1 ? 1 : value < end ? end : value;
 }
 
 
 /**
- * Get the current monotonic time as a double
+ * Calculate the luminosity of a channel while fading in
  * 
- * @param   now  Output parameter for the current time (monotonic)
- * @return       Zero on success, -1 on error
+ * @param   t       The number of seconds since the fade in began
+ * @param   time    The duration of the channel's fade in
+ * @param   target  The luminosity of the channel after the fade out
+ * @return          The luminosity of the channel
+ */
+static double
+fade_in_value(double t, double time, double target)
+{
+	double x;
+	if (t >= time)
+		return 1;
+	x = t / time;
+	return clip(target * (1 - x) + x);
+}
+
+
+/**
+ * Send the gamma ramps for a frame, unless
+ * they are unchanged since the last frame
+ * 
+ * @param   red    The red brightness
+ * @param   green  The green brightness
+ * @param   blue   The blue brightness
+ * @return         Zero on success, -1 on error, -2
+ *                 on libcoopgamma error
  */
 static int
-double_time(double *restrict now)
+send_frame(double red, double green, double blue)
 {
-#ifndef CLOCK_MONOTONIC_RAW
-# define CLOCK_MONOTONIC_RAW  CLOCK_MONOTONIC
-#endif
-	struct timespec ts;
-	if (clock_gettime(CLOCK_MONOTONIC_RAW, &ts) < 0)
-		return -1;
-	*now  = (double)(ts.tv_nsec);
-	*now /= 1000000000L;
-	*now += (double)(ts.tv_sec);
-	return 0;
+	if (red == sent_red && green == sent_green && blue == sent_blue)
+		return 0;
+	sent_red   = red;
+	sent_green = green;
+	sent_blue  = blue;
+
+	return fill_filters(&fill_filter, (double []){red, green, blue}, FILL_REFRESH);
+}
+
+
+/**
+ * Render a frame of the fade out
+ * 
+ * @param   t     The number of seconds since the fade out began
+ * @param   data  Not used
+ * @return        0: Success, the fade out continues
+ *                1: Success, every channel has reached its target
+ *                -1: Error, `errno` set
+ *                -2: Error, `cg.error` set
+ */
+static int
+fade_out(double t, void *data)
+{
+	double red, green, blue;
+	int r;
+
+	(void) data;
+
+	red   = fade_out_value(t, red_time,   red_target);
+	green = fade_out_value(t, green_time, green_target);
+	blue  = fade_out_value(t, blue_time,  blue_target);
+	if ((r = send_frame(red, green, blue)) < 0)
+		return r;
+
+	return red == clip(red_target) && green == clip(green_target) && blue == clip(blue_target);
+}
+
+
+/**
+ * Render a frame of the fade in
+ * 
+ * @param   t     The number of seconds since the fade in began
+ * @param   data  Not used
+ * @return        0: Success, the fade in continues
+ *                1: Success, every channel has reached full luminosity
+ *                -1: Error, `errno` set
+ *                -2: Error, `cg.error` set
+ */
+static int
+fade_in(double t, void *data)
+{
+	double red, green, blue;
+	int r;
+
+	(void) data;
+
+	red   = fade_in_value(t, red_time,   red_target);
+	green = fade_in_value(t, green_time, green_target);
+	blue  = fade_in_value(t, blue_time,  blue_target);
+	if ((r = send_frame(red, green, blue)) < 0)
+		return r;
+
+	return red == 1 && green == 1 && blue == 1;
 }
 
 
@@ -273,16 +418,9 @@ double_time(double *restrict now)
 int
 start(void)
 {
-	int r, fade_red, fade_green, fade_blue;
-	size_t i, j;
-	double t, starttime, red, green, blue, redt, greent, bluet;
-
-	redt   = (red_target   - 1) / red_time;
-	greent = (green_target - 1) / green_time;
-	bluet  = (blue_target  - 1) / blue_time;
-	fade_red   = !isinf(redt)   && !isnan(redt);
-	fade_green = !isinf(greent) && !isnan(greent);
-	fade_blue  = !isinf(bluet)  && !isnan(bluet);
+	int r;
+	size_t i;
+	double t, redt, greent, bluet;
 
 	for (i = 0; i < filters_n; i++)
 		crtc_updates[i].filter.lifespan = LIBCOOPGAMMA_UNTIL_DEATH;
@@ -290,90 +428,25 @@ start(void)
 	if ((r = make_slaves()) < 0)
 		return r;
 
-	if ((r = double_time(&starttime)) < 0)
+	if ((r = animate(&fade_out, NULL)) < 0)
 		return r;
 
-	red   = red_target   < 0 ? 0 : red_target   > 1 ? 1 : red_target;
-	green = green_target < 0 ? 0 : green_target > 1 ? 1 : green_target;
-	blue  = blue_target  < 0 ? 0 : blue_target  > 1 ? 1 : blue_target;
-
-	for (;;) {
-		if ((r = double_time(&t)) < 0)
-			return r;
-		t -= starttime;
-		if (fade_red) {
-			red = 1 + t * redt;
-			if (red > 1)
-				red = 1;
-			else if (red < 0)
-				red = 0;
-		}
-		if (fade_green) {
-			green = 1 + t * greent;
-			if (green > 1)
-				green = 1;
-			else if (green < 0)
-				green = 0;
-		}
-		if (fade_blue) {
-			blue = 1 + t * bluet;
-			if (blue > 1)
-				blue = 1;
-			else if (blue < 0)
-				blue = 0;
-		}
-
-		for (i = 0, r = 1; i < filters_n; i++) {
-			if (!crtc_updates[i].master || !crtc_info[crtc_updates[i].crtc].supported)
-				continue;
-			fill_filter(&crtc_updates[i].filter, red, green, blue);
-			r = update_filter(i, 0);
-			if (r == -2 || (r == -1 && errno != EAGAIN))
-				return r;
-			if (crtc_updates[i].slaves)
-				for (j = 0; crtc_updates[i].slaves[j]; j++) {
-					r = update_filter(crtc_updates[i].slaves[j], 0);
-					if (r == -2 || (r == -1 && errno != EAGAIN))
-						return r;
-				}
-		}
-
-		while (r != 1)
-			if ((r = synchronise(-1)) < 0)
-				return r;
-
-		sched_yield();
-
-		if (t >= red_time && t >= green_time && t >= blue_time)
-			break;
-	}
-
-	if (signal(SIGINT,  sig_int) == SIG_ERR ||
-	    signal(SIGTERM, sig_int) == SIG_ERR ||
-	    signal(SIGHUP,  sig_int) == SIG_ERR)
+	signal_source.handler = &signal_received;
+	if (event_signals(&signal_source, (const int []){SIGINT, SIGTERM, SIGHUP, 0}) < 0)
 		return -1;
-
-	if (libcoopgamma_set_nonblocking(&cg, 0) < 0)
+	if (event_add(&signal_source) < 0)
 		return -1;
-	for (;;) {
-		if (libcoopgamma_synchronise(&cg, NULL, 0, &j) < 0) {
-			if (received_int)
-				goto fade_in;
-			switch (errno) {
-			case 0:
-				break;
-			case ENOTRECOVERABLE:
+
+	while (!received_int) {
+		if ((r = event_wait(-1)) < 0) {
+			if (r == -1 && errno == EINTR)
+				continue;
+			if (r == -1 && errno == ENOTRECOVERABLE)
 				goto enotrecoverable;
-			default:
-				return 1;
-			}
+			return r;
 		}
 	}
 
-fade_in:
-	if (libcoopgamma_set_nonblocking(&cg, 1) < 0)
-		return -1;
-
 	t = red_time;
 	t = t > green_time ? t : green_time;
 	t = t > blue_time  ? t : blue_time;
@@ -391,67 +464,11 @@ fade_in:
 	green_time = t + greent;
 	blue_time  = t + bluet;
 
-	red = green = blue = 1;
-
-	if ((r = double_time(&starttime)) < 0)
-		return r;
-
-	for (;;) {
-		if ((r = double_time(&t)) < 0)
-			return r;
-		t -= starttime;
-		redt   = t / red_time;
-		greent = t / green_time;
-		bluet  = t / blue_time;
-		if (!isinf(redt) && !isnan(redt)) {
-			red = red_target * (1 - redt) + redt;
-			if (red > 1)
-				red = 1;
-			else if (red < 0)
-				red = 0;
-		}
-		if (!isinf(greent) && !isnan(greent)) {
-			green = green_target * (1 - greent) + greent;
-			if (green > 1)
-				green = 1;
-			else if (green < 0)
-				green = 0;
-		}
-		if (!isinf(bluet) && !isnan(bluet)) {
-			blue = blue_target * (1 - bluet) + bluet;
-			if (blue > 1)
-				blue = 1;
-			else if (blue < 0)
-				blue = 0;
-		}
-
-		for (i = 0, r = 1; i < filters_n; i++) {
-			if (!crtc_updates[i].master || !crtc_info[crtc_updates[i].crtc].supported)
-				continue;
-			fill_filter(&crtc_updates[i].filter, red, green, blue);
-			r = update_filter(i, 0);
-			if (r == -2 || (r == -1 && errno != EAGAIN))
-				return r;
-			if (crtc_updates[i].slaves) {
-				for (j = 0; crtc_updates[i].slaves[j]; j++) {
-					r = update_filter(crtc_updates[i].slaves[j], 0);
-					if (r == -2 || (r == -1 && errno != EAGAIN))
-						return r;
-				}
-			}
-		}
-
-		while (r != 1 && (r = synchronise(-1)) < 0)
-			return r;
-
-		sched_yield();
-
-		if (t >= red_time && t >= green_time && t >= blue_time)
-			break;
-	}
-
-	return 0;
+	return animate(&fade_in, NULL);
 enotrecoverable:
-	pause();
+	while (!received_int)
+		if ((r = event_wait(-1)) < 0 && errno != EINTR)
+			return r;
+	errno = ENOTRECOVERABLE;
 	return -1;
 }
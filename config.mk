@@ -7,4 +7,13 @@ CC = cc
 
 CPPFLAGS = -D_DEFAULT_SOURCE -D_BSD_SOURCE -D_XOPEN_SOURCE=700 -D'PKGNAME="$(PKGNAME)"'
 CFLAGS   = -std=c99 -Wall -O2
-LDFLAGS  = -lcoopgamma -lm -s
+LDFLAGS  = -lcoopgamma -lm -lpthread -s
+
+# cg-bake runs when the programs are built, so it is built for
+# the build machine; its flags should give the same floating-point
+# results as the flags for the programs, so that the curves it
+# bakes are identical to the curves the programs calculate
+HOSTCC       = $(CC)
+HOSTCPPFLAGS = $(CPPFLAGS)
+HOSTCFLAGS   = $(CFLAGS)
+HOSTLDFLAGS  = -lm